@@ -0,0 +1,124 @@
+// 对比旧的 vec/mat 实现（if 链下标访问、按列拷贝相乘）与 SIMD 内核的吞吐量
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include "algebra.h"
+
+using namespace MSRender;
+
+namespace legacy {
+    template<typename T>
+    struct vec4 {
+        T x, y, z, w;
+        vec4(T _x=0, T _y=0, T _z=0, T _w=0) : x(_x), y(_y), z(_z), w(_w) {}
+        T operator[](const size_t i) const {
+            if(i > 3) std::cerr << i << " vec access error\n";
+            if(i == 0) return x;
+            if(i == 1) return y;
+            if(i == 2) return z;
+            return w;
+        }
+        T& operator[](const size_t i) {
+            if(i > 3) std::cerr << i << " vec access error\n";
+            if(i == 0) return x;
+            if(i == 1) return y;
+            if(i == 2) return z;
+            return w;
+        }
+        T operator*(const vec4& a) const { return a.x*x + a.y*y + a.z*z + a.w*w; }
+    };
+
+    template<typename T>
+    struct mat4 {
+        vec4<T> data[4];
+        vec4<T> operator[](const size_t i) const { return data[i]; }
+        vec4<T>& operator[](const size_t i) { return data[i]; }
+        vec4<T> column(size_t i) const { return vec4<T>(data[0][i], data[1][i], data[2][i], data[3][i]); }
+        mat4 operator*(const mat4& m) const {
+            mat4 ret;
+            for(size_t i = 0; i < 4; i++)
+                for(size_t j = 0; j < 4; j++)
+                    ret[i][j] = (*this)[i] * m.column(j);
+            return ret;
+        }
+        vec4<T> operator*(const vec4<T>& v) const { return vec4<T>(data[0]*v, data[1]*v, data[2]*v, data[3]*v); }
+    };
+}
+
+template<typename F>
+static double run(const char* name, size_t n, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    double sink = f();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-28s %8.1f M ops/s  (checksum %g)\n", name, n / sec * 1e-6, sink);
+    return sec;
+}
+
+template<typename T>
+static void bench(const char* type_name, size_t n) {
+    std::vector<T> seed(64);
+    for(size_t i = 0; i < seed.size(); i++) seed[i] = T(0.25) + T(i % 7) * T(0.125);
+
+    legacy::mat4<T> lm;
+    mat<4, 4, T> m;
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++)
+            lm[i][j] = m[i][j] = seed[i*4+j];
+
+    // 批量变换互不相关的输入，与渲染器中逐顶点 / 逐模型变换的用法一致
+    const size_t batch = 4096, rounds = n / batch;
+    std::vector<legacy::vec4<T>> lv(batch), lout(batch);
+    std::vector<vec<4, T>> sv(batch), sout(batch);
+    std::vector<legacy::mat4<T>> lms(batch / 4), lmout(batch / 4);
+    std::vector<mat<4, 4, T>> sms(batch / 4), smout(batch / 4);
+    for(size_t i = 0; i < batch; i++) {
+        T x = seed[i % 64], y = seed[(i + 5) % 64], z = seed[(i + 11) % 64];
+        lv[i] = legacy::vec4<T>(x, y, z, 1);
+        sv[i] = vec<4, T>(x, y, z, 1);
+        if(i < batch / 4) lms[i] = lm, sms[i] = m, lms[i][0][0] = sms[i][0][0] = x;
+    }
+
+    std::printf("-- %s --\n", type_name);
+    double t_old = run("legacy mat * vec", rounds * batch, [&] {
+        double sum = 0;
+        for(size_t r = 0; r < rounds; r++) {
+            for(size_t i = 0; i < batch; i++) lout[i] = lm * lv[i];
+            sum += lout[r % batch].x;
+        }
+        return sum;
+    });
+    double t_new = run("simd mat * vec", rounds * batch, [&] {
+        double sum = 0;
+        for(size_t r = 0; r < rounds; r++) {
+            for(size_t i = 0; i < batch; i++) sout[i] = m * sv[i];
+            sum += sout[r % batch].x;
+        }
+        return sum;
+    });
+    std::printf("%-28s %8.2fx\n", "speedup", t_old / t_new);
+
+    t_old = run("legacy mat * mat", rounds * batch / 4, [&] {
+        double sum = 0;
+        for(size_t r = 0; r < rounds; r++) {
+            for(size_t i = 0; i < batch / 4; i++) lmout[i] = lm * lms[i];
+            sum += lmout[r % (batch / 4)][1][2];
+        }
+        return sum;
+    });
+    t_new = run("simd mat * mat", rounds * batch / 4, [&] {
+        double sum = 0;
+        for(size_t r = 0; r < rounds; r++) {
+            for(size_t i = 0; i < batch / 4; i++) smout[i] = m * sms[i];
+            sum += smout[r % (batch / 4)][1][2];
+        }
+        return sum;
+    });
+    std::printf("%-28s %8.2fx\n", "speedup", t_old / t_new);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+    bench<double>("double", n);
+    bench<float>("float", n);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+// 对比旧的 getline + istringstream 逐行解析、串行 load_obj 与分段并行 load_obj 的加载时间
+// 用法：obj_bench [网格边长] [线程数]，在自带模型之外生成边长为 N 的合成网格：
+// 一个由 2*N*N 个三角形组成，一个由 N*N 个四边形组成（旧的解析不做三角化，四边形网格只对比串行与并行）
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "objloader.h"
+#include "threadpool.h"
+
+using namespace MSRender;
+
+// 原 Model::Model 中的解析循环，只保留几何数据
+static bool legacy_parse(const std::string& filename, ObjData& out) {
+    std::ifstream in(filename);
+    if(in.fail()) return false;
+    std::string line, _;
+    while(!in.eof()) {
+        std::getline(in, line);
+        std::istringstream iss(line);
+        if(!line.compare(0, 2, "v ")) {
+            pointr v;
+            iss >> _ >> v.x >> v.y >> v.z;
+            v.w = 1;
+            out.positions.push_back(v);
+        }
+        else if(!line.compare(0, 3, "vt ")) {
+            uvr vt;
+            iss >> _ >> vt.u >> vt.v;
+            out.uvs.push_back(vt);
+        }
+        else if(!line.compare(0, 3, "vn ")) {
+            vecr vn;
+            iss >> _ >> vn.x >> vn.y >> vn.z;
+            out.normals.push_back(vn);
+        }
+        else if(!line.compare(0, 2, "f ")) {
+            int v, t, n, cnt = 0;
+            char c;
+            iss >> c;
+            while(iss >> v >> c >> t >> c >> n) {
+                out.corner_v.push_back(v-1);
+                out.corner_vt.push_back(t-1);
+                out.corner_vn.push_back(n-1);
+                cnt++;
+            }
+            out.face_size.push_back(cnt);
+        }
+    }
+    return true;
+}
+
+static void write_grid(const std::string& path, int n, bool quads) {
+    std::ofstream out(path);
+    for(int y = 0; y <= n; y++)
+        for(int x = 0; x <= n; x++)
+            out << "v " << x / (double)n - 0.5 << " " << 0.01 * ((x * 7 + y * 13) % 17) << " " << y / (double)n - 0.5 << "\n";
+    for(int y = 0; y <= n; y++)
+        for(int x = 0; x <= n; x++)
+            out << "vt " << x / (double)n << " " << y / (double)n << "\n";
+    out << "vn 0 1 0\n";
+    for(int y = 0; y < n; y++) {
+        for(int x = 0; x < n; x++) {
+            int a = y * (n + 1) + x + 1, b = a + 1, c = a + n + 1, d = c + 1;
+            if(quads) {
+                out << "f " << a << "/" << a << "/1 " << c << "/" << c << "/1 " << d << "/" << d << "/1 " << b << "/" << b << "/1\n";
+                continue;
+            }
+            out << "f " << a << "/" << a << "/1 " << c << "/" << c << "/1 " << b << "/" << b << "/1\n";
+            out << "f " << b << "/" << b << "/1 " << c << "/" << c << "/1 " << d << "/" << d << "/1\n";
+        }
+    }
+}
+
+static bool same(const ObjData& a, const ObjData& b) {
+    if(a.positions.size() != b.positions.size() || a.uvs.size() != b.uvs.size() || a.normals.size() != b.normals.size()) return false;
+    for(size_t i = 0; i < a.positions.size(); i++)
+        if(a.positions[i].x != b.positions[i].x || a.positions[i].y != b.positions[i].y || a.positions[i].z != b.positions[i].z) return false;
+    for(size_t i = 0; i < a.uvs.size(); i++)
+        if(a.uvs[i].u != b.uvs[i].u || a.uvs[i].v != b.uvs[i].v) return false;
+    return a.corner_v == b.corner_v && a.corner_vt == b.corner_vt && a.corner_vn == b.corner_vn;
+}
+
+static void bench(const std::string& path, ThreadPool& pool, bool compare_legacy = true) {
+    using clock = std::chrono::steady_clock;
+    ObjData legacy, serial, parallel;
+    std::string error;
+    auto start = clock::now();
+    if(!legacy_parse(path, legacy)) {
+        std::printf("%-48s cannot open\n", path.c_str());
+        return;
+    }
+    double t_legacy = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    start = clock::now();
+    bool ok = load_obj(path, serial, error);
+    double t_serial = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    start = clock::now();
+    ok = ok && load_obj(path, parallel, error, &pool);
+    double t_parallel = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    if(!ok) {
+        std::printf("%-48s %s\n", path.c_str(), error.c_str());
+        return;
+    }
+    std::printf("%-48s %8zu faces  legacy %9.2f ms  serial %8.2f ms (%5.1fx)  %zu threads %8.2f ms (%5.1fx)  %s\n",
+                path.c_str(), serial.face_size.size(), t_legacy, t_serial, t_legacy / t_serial, pool.size(), t_parallel, t_legacy / t_parallel,
+                (!compare_legacy || same(legacy, serial)) && same(serial, parallel) ? "identical" : "MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 500;
+    ThreadPool pool(argc > 2 ? std::atoi(argv[2]) : std::thread::hardware_concurrency());
+    const char* bundled[] = {"../obj/floor.obj", "../obj/african_head/african_head.obj",
+                             "../obj/african_head/african_head_eye_inner.obj", "../obj/diablo3_pose/diablo3_pose.obj"};
+    for(const char* path: bundled) bench(path, pool);
+    std::string grid = "synthetic_grid.obj";
+    write_grid(grid, n, false);
+    bench(grid, pool);
+    write_grid(grid, n, true);
+    bench(grid, pool, false);
+    std::remove(grid.c_str());
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+// 对比各阴影过滤方式每次 visibility 查询的耗时，以及相对单次比较（hard）的倍数
+// 用法：shadow_bench [贴图边长] [查询次数（百万）]，贴图中随机绘制若干遮挡三角形。
+// 查询点分两种：random 在贴图上均匀随机分布；rows 按行扫描，接近光栅化时相邻片元的访问顺序
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "shadowmap.h"
+#include "threadpool.h"
+
+using namespace MSRender;
+
+static double run(const ShadowMap& map, const std::vector<pointr>& queries, double& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    for(const pointr& q: queries) sum += map.visibility(q, 0.005);
+    double t = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    checksum += sum;
+    return t / queries.size();
+}
+
+int main(int argc, char** argv) {
+    int size = argc > 1 ? std::atoi(argv[1]) : 2048;
+    size_t n = (argc > 2 ? std::atof(argv[2]) : 2) * 1e6;
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<real> dist(-1, 1);
+    ThreadPool pool(1);
+
+    // 遮挡三角形的深度在 [0, 1]，查询点的深度在 [-1, 1]，大约一半的查询点落在半影或阴影中
+    std::vector<pointr> ndc;
+    for(int i = 0; i < 400; i++) {
+        const real cx = dist(rng), cy = dist(rng), z = dist(rng) * 0.5 + 0.5;
+        for(int j = 0; j < 3; j++) ndc.push_back(pointr(cx + dist(rng) * 0.15, cy + dist(rng) * 0.15, z, 1));
+    }
+    std::vector<pointr> random(n), rows(n);
+    for(pointr& q: random) q = pointr(dist(rng), dist(rng), dist(rng), 1);
+    const size_t side = std::sqrt((double)n);
+    for(size_t i = 0; i < n; i++) rows[i] = pointr((i % side + 0.5) / side * 2 - 1, (i / side % side + 0.5) / side * 2 - 1, dist(rng), 1);
+
+    // 覆盖整张贴图的两个三角形必须写满所有像素，包括超出屏幕尺寸 W x H 的部分
+    bool covered = true;
+    for(ShadowFormat format: {ShadowFormat::float32, ShadowFormat::depth16}) {
+        ShadowMap map(size, format);
+        const std::vector<pointr> quad = {pointr(0, 0, 0.5, 1), pointr(size, 0, 0.5, 1), pointr(size, size, 0.5, 1),
+                                          pointr(0, 0, 0.5, 1), pointr(size, size, 0.5, 1), pointr(0, size, 0.5, 1)};
+        map.render(quad, pool);
+        for(int y = 0; y < size; y++)
+            for(int x = 0; x < size; x++) covered = covered && map.depth(x, y) > -1;
+    }
+    std::printf("%dx%d full-map coverage %s\n", size, size, covered ? "ok" : "MISSING");
+
+    const char* names[] = {"hard", "pcf3x3", "pcf5x5", "poisson16", "poisson32", "pcss"};
+    const ShadowFormat formats[] = {ShadowFormat::float32, ShadowFormat::depth16};
+    double checksum = 0;
+    for(ShadowFormat format: formats) {
+        ShadowMap map(size, format);
+        std::vector<pointr> corners;
+        for(const pointr& p: ndc) corners.push_back(map.to_texel(p));
+        map.render(corners, pool);
+        for(const char* pattern: {"random", "rows"}) {
+            double hard = 0;
+            for(int f = 0; f < 6; f++) {
+                ShadowMap::filter = (ShadowFilter)f;
+                const double t = run(map, pattern[0] == 'r' && pattern[1] == 'a' ? random : rows, checksum);
+                if(!f) hard = t;
+                std::printf("%dx%d %-7s %-6s %-9s %7.1f ns/lookup  %5.1fx hard\n", size, size, format == ShadowFormat::float32 ? "float32" : "depth16",
+                            pattern, names[f], t, t / hard);
+            }
+        }
+    }
+    std::printf("checksum %.1f\n", checksum);
+    return covered ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+// 对比按行存放与 4x4 分块存放的纹理在不同访问模式下的采样吞吐量，并与直接读 TGAImage 对比；
+// 双线性分别测逐个采样与每次 8 个的批量采样（支持 AVX2 时使用 gather）
+// 用法：texture_bench [贴图路径] [采样次数（百万）]，贴图无法读取时生成一张 2048x2048 的合成贴图
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "texture.h"
+
+using namespace MSRender;
+
+// 生成 n 个采样坐标：random 为均匀随机；rows 沿纹理的行扫描（u 变化最快）；
+// columns 沿纹理的列扫描（v 变化最快），相当于屏幕光栅化一个旋转了 90 度的表面
+static std::vector<uvr> make_uvs(const char* pattern, size_t n, int w, int h) {
+    std::vector<uvr> uvs(n);
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<real> dist(0, 1);
+    for(size_t i = 0; i < n; i++) {
+        const size_t a = i % ((size_t)w * h);
+        if(pattern[0] == 'r' && pattern[1] == 'a') uvs[i] = uvr(dist(rng), dist(rng));
+        else if(pattern[0] == 'r') uvs[i] = uvr((a % w + real(0.3)) / w, (a / w + real(0.7)) / h);
+        else uvs[i] = uvr((a / h + real(0.3)) / w, (a % h + real(0.7)) / h);
+    }
+    return uvs;
+}
+
+// 每次批量采样 Texture::batch 个坐标，返回 M samples/s
+static double run_batch(const Texture& tex, const std::vector<uvr>& uvs, int n, double& checksum) {
+    std::vector<float> u(uvs.size()), v(uvs.size());
+    for(size_t i = 0; i < uvs.size(); i++) u[i] = uvs[i].u, v[i] = uvs[i].v;
+    const int level[Texture::batch] = {};
+    alignas(32) float out[4][Texture::batch];
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    for(size_t i = 0; i + n <= uvs.size(); i += n) {
+        tex.sample_bilinear(&u[i], &v[i], level, n, TextureWrap::repeat, out);
+        for(int k = 0; k < n; k++) sum += out[0][k];
+    }
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    checksum += sum;
+    return uvs.size() / t * 1e-6;
+}
+
+template<typename F>
+static double run(const std::vector<uvr>& uvs, F&& sample, double& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    for(const uvr& uv: uvs) sum += sample(uv);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    checksum += sum;
+    return uvs.size() / t * 1e-6;
+}
+
+int main(int argc, char** argv) {
+    TGAImage img;
+    if(argc < 2 || !img.read_tga_file(argv[1])) {
+        img = TGAImage(2048, 2048, TGAImage::RGB);
+        for(int y = 0; y < 2048; y++)
+            for(int x = 0; x < 2048; x++) img.set(x, y, TGAColor(x * 7 + y, x ^ y, y * 3));
+    }
+    const size_t n = (argc > 2 ? std::atof(argv[2]) : 8) * 1e6;
+    Texture linear(img, TextureLayout::linear), tiled(img, TextureLayout::tiled);
+    const int w = img.get_width(), h = img.get_height();
+    std::printf("%dx%d texture, %zu samples per run (M samples/s)\n", w, h, n);
+    std::printf("%-8s %10s %10s %10s %14s %14s %14s %14s\n", "pattern", "TGAImage", "linear", "tiled",
+                "linear bil x1", "tiled bil x1", "linear bil x8", "tiled bil x8");
+    double checksum = 0;
+    for(const char* pattern: {"random", "rows", "columns"}) {
+        std::vector<uvr> uvs = make_uvs(pattern, n, w, h);
+        double t_image = run(uvs, [&](const uvr& uv) { return img.get(uv.u * w, uv.v * h)[0]; }, checksum);
+        double t_linear = run(uvs, [&](const uvr& uv) { return linear.fetch_packed(uv.u, uv.v) & 255; }, checksum);
+        double t_tiled = run(uvs, [&](const uvr& uv) { return tiled.fetch_packed(uv.u, uv.v) & 255; }, checksum);
+        double t_linear_1 = run_batch(linear, uvs, 1, checksum), t_tiled_1 = run_batch(tiled, uvs, 1, checksum);
+        double t_linear_8 = run_batch(linear, uvs, Texture::batch, checksum), t_tiled_8 = run_batch(tiled, uvs, Texture::batch, checksum);
+        std::printf("%-8s %10.1f %10.1f %10.1f %14.1f %14.1f %14.1f %14.1f\n", pattern, t_image, t_linear, t_tiled, t_linear_1, t_tiled_1, t_linear_8, t_tiled_8);
+    }
+    std::printf("checksum %.0f\n", checksum);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+// 对比逐顶点的 VertexShader::shading 与 SoA 批量变换的吞吐量
+// 用法：vertex_bench [模型路径] [重复次数]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "model.h"
+#include "shader.h"
+
+using namespace MSRender;
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : "../obj/diablo3_pose/diablo3_pose.obj";
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+    Model model(path);
+    model.set_model_matrix(ModelTransfParam());
+    const size_t n = model.vertexs_size();
+    if(!n) return 1;
+    VertexShader shader;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Vertex> single(n);
+    for(int r = 0; r < rounds; r++)
+        for(size_t v = 0; v < n; v++) single[v] = shader.shading(model, v);
+    double t_single = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    VertexBatch batch;
+    batch.resize(n);
+    for(int r = 0; r < rounds; r++) shader.shading(model, 0, n, batch);
+    double t_batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t mismatch = 0;
+    for(size_t v = 0; v < n; v++)
+        if(single[v].screen_pos.x != batch.sx[v] || single[v].screen_pos.y != batch.sy[v] || single[v].w != batch.w[v]
+           || single[v].normal.x != batch.normal.x[v])
+            mismatch++;
+
+    double total = double(n) * rounds;
+    std::printf("%zu vertices x %d rounds\n", n, rounds);
+    std::printf("per-vertex shading %8.1f M vertices/s\n", total / t_single * 1e-6);
+    std::printf("batch shading      %8.1f M vertices/s  (%.2fx)\n", total / t_batch * 1e-6, t_single / t_batch);
+    std::printf("mismatching vertices: %zu\n", mismatch);
+    return 0;
+}
\ No newline at end of file
@@ -2,8 +2,21 @@
 #define __ALGEBRA_H__
 #include <iostream>
 #include <cmath>
+#include <type_traits>
+#include "simd.h"
 
 namespace MSRender {
+    // 渲染管线使用的浮点精度，编译时由 MSR_USE_FLOAT 选择
+#ifdef MSR_USE_FLOAT
+    using real = float;
+#else
+    using real = double;
+#endif
+
+    // 浮点向量与标量运算时保持自身精度，整数向量仍按 double 计算
+    template<typename T>
+    using scalar_t = typename std::conditional<std::is_floating_point<T>::value, T, double>::type;
+
     template<size_t n, typename T>
     struct vec { };
 
@@ -20,11 +33,15 @@ namespace MSRender {
         }
 
         T operator[](size_t i) const {
-            if(i > 1 || i < 0) std::cerr << i << " uv access error\n";
+#ifndef NDEBUG
+            if(i > 1) std::cerr << i << " uv access error\n";
+#endif
             return i == 0 ? u : v;
         }
         T& operator[](size_t i) {
-            if(i > 1 || i < 0) std::cerr << i << " uv access error\n";
+#ifndef NDEBUG
+            if(i > 1) std::cerr << i << " uv access error\n";
+#endif
             return i == 0 ? u : v;
         }
 
@@ -35,17 +52,17 @@ namespace MSRender {
             for(size_t i = 0; i < 2; i++) (*this)[i] += b[i];
             return *this;
         }
-        vec<2, T> operator*(double c) const {
+        vec<2, T> operator*(scalar_t<T> c) const {
             return vec<2, T>(u*c, v*c);
         }
-        vec<2, T>& operator*=(double c) {
+        vec<2, T>& operator*=(scalar_t<T> c) {
             *this = (*this) * c;
             return *this;
         }
-        vec<2, T> operator/(double c) const {
+        vec<2, T> operator/(scalar_t<T> c) const {
             return vec<2, T>(u/c, v/c);
         }
-        vec<2, T>& operator/=(double c) {
+        vec<2, T>& operator/=(scalar_t<T> c) {
             for(size_t i = 0; i < 2; i++) (*this)[i] /= c;
             return *this;
         }
@@ -61,9 +78,11 @@ namespace MSRender {
     using uvd = vec<2, double>;
     using uvf = vec<2, float>;
     using uvi = vec<2, int>;
+    using uvr = vec<2, real>;
 
+    // 按 4 个元素的大小对齐，便于 SIMD 整体读写
     template<typename T>
-    struct vec<4, T> {
+    struct alignas(4 * sizeof(T)) vec<4, T> {
         T x, y, z, w;
         ~vec() = default;
         vec(T _x=0, T _y=0, T _z=0, T _w=0) noexcept // w = 0 is vec, w = 1 is point
@@ -75,29 +94,28 @@ namespace MSRender {
             return *this;
         }
 
+        // 通过成员指针表访问，没有分支；越界检查只在调试构建中进行
         T operator[](const size_t i) const {
-            if(i > 3 || i < 0) std::cerr << i << " vec access error\n";
-            if(i == 0) return x;
-            if(i == 1) return y;
-            if(i == 2) return z;
-            return w;
+#ifndef NDEBUG
+            if(i > 3) std::cerr << i << " vec access error\n";
+#endif
+            return this->*members[i & 3];
         }
         T& operator[](const size_t i) {
-            if(i > 3 || i < 0) std::cerr << i << " vec access error\n";
-            if(i == 0) return x;
-            if(i == 1) return y;
-            if(i == 2) return z;
-            return w;
+#ifndef NDEBUG
+            if(i > 3) std::cerr << i << " vec access error\n";
+#endif
+            return this->*members[i & 3];
         }
 
-        vec<4, T> operator*(double c) const {
+        vec<4, T> operator*(scalar_t<T> c) const {
             return vec<4, T>(x*c, y*c, z*c, w*c);
         }
-        vec<4, T>& operator*=(double c) {
+        vec<4, T>& operator*=(scalar_t<T> c) {
             x *= c, y *= c, z *= c, w *= c;
             return *this;
         }
-        double operator*(const vec<4, T>& a) const {
+        scalar_t<T> operator*(const vec<4, T>& a) const {
             return a.x*x + a.y*y + a.z*z + a.w*w;
         }
         vec<4, T> operator+(const vec<4, T>& b) const {
@@ -107,16 +125,16 @@ namespace MSRender {
             for(size_t i = 0; i < 4; i++) (*this)[i] += b[i];
             return *this;
         }
-        vec<4, T> operator/(double c) const {
+        vec<4, T> operator/(scalar_t<T> c) const {
             return vec<4, T>(x/c, y/c, z/c, w/c);
         }
-        vec<4, T>& operator/=(double c) {
+        vec<4, T>& operator/=(scalar_t<T> c) {
             x /= c, y /= c, z /= c, w /= c;
             return *this;
         }
 
-        double norm2() const { return x*x+y*y+z*z; }
-        double norm() const { return std::sqrt(norm2()); }
+        scalar_t<T> norm2() const { return x*x+y*y+z*z; }
+        scalar_t<T> norm() const { return std::sqrt(norm2()); }
         vec<4, T> normalized() const {
             return (*this) / norm();
         }
@@ -131,20 +149,28 @@ namespace MSRender {
             }
             return out;
         }
+    private:
+        static constexpr T vec::* members[4] = {&vec::x, &vec::y, &vec::z, &vec::w};
     };
 
+    // 混合精度运算的结果类型：两个浮点类型取较宽者，含整数时按 double 计算
+    template<typename T, typename U>
+    using common_t = typename std::conditional<std::is_floating_point<T>::value && std::is_floating_point<U>::value,
+                                               typename std::common_type<T, U>::type, double>::type;
+
     template<typename T, typename U>
-    vec<4, double> cross(const vec<4, T>& a, const vec<4, U>& b) {
-        return vec<4, double>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x, 0);
+    vec<4, common_t<T, U>> cross(const vec<4, T>& a, const vec<4, U>& b) {
+        return vec<4, common_t<T, U>>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x, 0);
     }
 
     using vecd = vec<4, double>; using pointd = vec<4, double>;
     using vecf = vec<4, float>;  using pointf = vec<4, float>;
     using veci = vec<4, int>;    using pointi = vec<4, int>;
+    using vecr = vec<4, real>;   using pointr = vec<4, real>;
 
     template<typename T, typename U>
-    vecd operator-(const vec<4, T>& a, const vec<4, U>& b) {
-        return vecd(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w);
+    vec<4, common_t<T, U>> operator-(const vec<4, T>& a, const vec<4, U>& b) {
+        return vec<4, common_t<T, U>>(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w);
     }
 
     template<size_t row, size_t col, typename T>
@@ -152,7 +178,8 @@ namespace MSRender {
 
     template<typename T>
     struct mat<4, 4, T> {
-        vec<4, T> data[4];
+        vec<4, T> data[4];   // 按行存储，16 个元素连续
+        static_assert(sizeof(vec<4, T>) == 4 * sizeof(T), "vec<4, T> must be tightly packed");
         mat(bool is_I = false) noexcept {
             for(size_t i = 0; i < 4; i++) data[i] = vec<4, T>(0, 0, 0, 0);
             if(is_I) for(size_t i = 0; i < 4; i++) data[i][i] = 1;
@@ -165,17 +192,18 @@ namespace MSRender {
             for(size_t i = 0; i < 4; i++) data[i] = m.data[i];
             return *this;
         }
-        vec<4, T> operator[](const size_t i) const { return data[i]; }
+        const vec<4, T>& operator[](const size_t i) const { return data[i]; }
         vec<4, T>& operator[](const size_t i) { return data[i]; }
         vec<4, T> column(size_t i) const {
             return vec<4, T>(data[0][i], data[1][i], data[2][i], data[3][i]);
         }
 
+        const T* elements() const { return &data[0].x; }
+        T* elements() { return &data[0].x; }
+
         mat<4, 4, T> operator*(const mat<4, 4, T>& m) const {
             mat<4, 4, T> ret;
-            for(size_t i = 0; i < 4; i++)
-                for(size_t j = 0; j < 4; j++)
-                    ret[i][j] = (*this)[i] * m.column(j);
+            simd::mat4_mul_mat4(elements(), m.elements(), ret.elements());
             return ret;
         }
 
@@ -192,9 +220,9 @@ namespace MSRender {
             return ret;
         }
 
-        mat<4, 4, double> inverse() {
-            mat<4, 4, double> a = (*this);
-            mat<4, 4, double> b(true);
+        mat<4, 4, scalar_t<T>> inverse() {
+            mat<4, 4, scalar_t<T>> a = (*this);
+            mat<4, 4, scalar_t<T>> b(true);
             for(int i = 0; i < 4; i++) {
                 int main_r = i;
                 for(int j = 0; j < 4; j++) {
@@ -207,7 +235,7 @@ namespace MSRender {
                 }
                 if(main_r != i) std::swap(a[main_r], a[i]), std::swap(b[main_r], b[i]);
                 for(int k = 0; k < 4; k++) if(k != i) {
-                    double p = a[k][i] / a[i][i];
+                    scalar_t<T> p = a[k][i] / a[i][i];
                     for(int j = 0; j < 4; j++) {
                         a[k][j] -= p*a[i][j];
                         b[k][j] -= p*b[i][j];
@@ -221,10 +249,23 @@ namespace MSRender {
     using mat4d = mat<4, 4, double>;
     using mat4f = mat<4, 4, float>;
     using mat4i = mat<4, 4, int>;
+    using mat4r = mat<4, 4, real>;
 
     template<typename T, typename U>
-    vec<4, double> operator*(const mat<4, 4, U>& m, const vec<4, T>& v) {
-        return vec<4, double>(m[0]*v, m[1]*v, m[2]*v, m[3]*v);
+    vec<4, common_t<T, U>> operator*(const mat<4, 4, U>& m, const vec<4, T>& v) {
+        return vec<4, common_t<T, U>>(m[0]*v, m[1]*v, m[2]*v, m[3]*v);
+    }
+
+    // 同类型的矩阵乘向量走 SIMD 内核
+    inline vecd operator*(const mat4d& m, const vecd& v) {
+        vecd ret;
+        simd::mat4_mul_vec4(m.elements(), &v.x, &ret.x);
+        return ret;
+    }
+    inline vecf operator*(const mat4f& m, const vecf& v) {
+        vecf ret;
+        simd::mat4_mul_vec4(m.elements(), &v.x, &ret.x);
+        return ret;
     }
 }
 
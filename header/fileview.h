@@ -0,0 +1,25 @@
+#ifndef __FILEVIEW_H__
+#define __FILEVIEW_H__
+#include <string>
+
+namespace MSRender {
+    // 只读访问整个文件的内容：优先 mmap，不支持 mmap 的平台整体读入
+    class FileView {
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+        void* map = nullptr;
+        std::string buffer;
+    public:
+        FileView() = default;
+        ~FileView();
+        FileView(const FileView&) = delete;
+        FileView& operator=(const FileView&) = delete;
+
+        bool open(const std::string& filename);
+        const char* begin() const { return data_; }
+        const char* end() const { return data_ + size_; }
+        size_t size() const { return size_; }
+    };
+}
+
+#endif
\ No newline at end of file
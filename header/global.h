@@ -4,10 +4,12 @@
 
 constexpr int H = 1200;
 constexpr int W = 1200;
+// 并行光栅化时屏幕 tile 的边长
+constexpr int tile_size = 64;
 
-const MSRender::pointd eye_pos(1.3, 1, 2, 1);
-const MSRender::pointd center(0, 0, 0, 1);
-const MSRender::vecd eye_up_dir(0, 1, 0, 0);
+const MSRender::pointr eye_pos(1.3, 1, 2, 1);
+const MSRender::pointr center(0, 0, 0, 1);
+const MSRender::vecr eye_up_dir(0, 1, 0, 0);
 constexpr double amb_light_intensity = 15.;
 
 constexpr double eye_fov = 90.;
@@ -18,6 +20,6 @@ constexpr double shadow_map_size = 2.;
 
 constexpr double PI = 3.141592653;
 
-// MSRender::mat4d light_space_matrix;
+// MSRender::mat4r light_space_matrix;
 
 #endif
\ No newline at end of file
@@ -4,48 +4,88 @@
 #include <string>
 #include "tgaimage.h"
 #include "algebra.h"
+#include "texture.h"
 
 namespace MSRender{
+    class ThreadPool;
+
     
     struct ModelTransfParam {
-        double scale[3] = {1., 1., 1.};
-        double thetas[3] = {0., 0., 0.};
-        MSRender::vecd translate;
+        real scale[3] = {1., 1., 1.};
+        real thetas[3] = {0., 0., 0.};
+        MSRender::vecr translate;
+        bool two_sided = false;   // 双面渲染的模型不做背面剔除
     };
     
+    // 三维坐标按分量分开存放（SoA），便于批量变换
+    struct Vec3Stream {
+        std::vector<real> x, y, z;
+        size_t size() const { return x.size(); }
+        void reserve(size_t n) { x.reserve(n), y.reserve(n), z.reserve(n); }
+        void resize(size_t n) { x.resize(n), y.resize(n), z.resize(n); }
+        void push(real x_, real y_, real z_) { x.push_back(x_), y.push_back(y_), z.push_back(z_); }
+    };
+
+    // 一组片元（最多 Texture::batch 个）的贴图采样结果，换算方式与逐片元的 get_* 相同
+    struct MaterialSamples {
+        vecr diffuse[Texture::batch], normal[Texture::batch], glow[Texture::batch];
+        real specular[Texture::batch];
+    };
+
     class Model {
     private:
-        std::vector<pointd> vertices;
-        std::vector<uvd> uvs;
-        std::vector<vecd> normals;
-        std::vector<int> face_vertices;
-        std::vector<int> face_uvs;
-        std::vector<int> face_normal;
-        bool has_diffusemap;
+        // 每个不同的 (v, vt, vn) 组合只保存一份，面通过 indices 引用
+        Vec3Stream positions;
+        std::vector<uvr> uvs;
+        Vec3Stream normals;
+        std::vector<int> indices;
+        bool has_diffusemap = false;
         TGAImage diffusemap_;         // diffuse color texture
-        bool has_normalmap;
+        bool has_normalmap = false;
         TGAImage normalmap_;          // normal map texture
-        bool has_specularmap;
+        bool has_specularmap = false;
         TGAImage specularmap_;        // specular map texture
-        bool has_glowmap;
+        bool has_glowmap = false;
         TGAImage glowmap_;            // glow map texture
+        // 由以上四张贴图生成的按块存放的 mip 链，所有采样都从这里读取
+        Texture diffuse_mips_, normal_mips_, specular_mips_, glow_mips_;
         bool load_texture(const std::string filename, const std::string suffix, TGAImage &img);
+        // 从 OBJ 与 TGA 文件加载
+        bool load_source(const std::string& filename, ThreadPool* pool);
+        void build_mipmaps(ThreadPool* pool);
+        // 二进制网格缓存，格式见 meshcache.cpp
+        bool read_cache(const std::string& filename);
+        bool write_cache(const std::string& filename) const;
     public:
         Model() {}
-        Model(const std::string filename);
-        size_t vertexs_size() const;
+        // 给出 pool 时大文件分段并行解析
+        Model(const std::string filename, ThreadPool* pool = nullptr);
+        size_t vertexs_size() const;      // 去重后的顶点数
         size_t faces_size() const;
-        vecd get_normal(const size_t iface, const size_t nthvert) const;  // per triangle corner normal vertex
-        pointd get_vertex(const size_t iface, const size_t nthvert) const;
-        uvd get_uv(const size_t iface, const size_t nthvert) const;
-        vecd get_diffuse(const uvd &uv) const;
-        vecd get_glow(const uvd &uv) const;
-        double get_specular(const uvd &uv) const;
-        vecd get_diffuse(const double uv0, const double uv1) const;
-        vecd get_glow(const double uv0, const double uv1) const;
-        double get_specular(const double uv0, const double uv1) const;
-        vecd get_normal_with_map(const uvd &uv) const; // fetch the normal vector from the normal map texture
-        vecd get_normal_with_map(const double uv0, const double uv1) const;
+        int get_index(const size_t iface, const size_t nthvert) const;
+        pointr get_vertex(const size_t index) const;
+        uvr get_uv(const size_t index) const;
+        vecr get_normal(const size_t index) const;
+        const Vec3Stream& get_positions() const { return positions; }
+        const Vec3Stream& get_normals() const { return normals; }
+        vecr get_normal(const size_t iface, const size_t nthvert) const;  // per triangle corner normal vertex
+        pointr get_vertex(const size_t iface, const size_t nthvert) const;
+        uvr get_uv(const size_t iface, const size_t nthvert) const;
+        vecr get_diffuse(const uvr &uv) const;
+        vecr get_glow(const uvr &uv) const;
+        real get_specular(const uvr &uv) const;
+        vecr get_diffuse(const real uv0, const real uv1) const;
+        vecr get_glow(const real uv0, const real uv1) const;
+        real get_specular(const real uv0, const real uv1) const;
+        vecr get_normal_with_map(const uvr &uv) const; // fetch the normal vector from the normal map texture
+        vecr get_normal_with_map(const real uv0, const real uv1) const;
+        // 带屏幕空间差分（相邻一个像素时 uv 的变化量）的采样，按 texture_filter 选择 mip 层与过滤方式
+        vecr get_diffuse(const uvr& uv, const uvr& dx, const uvr& dy) const;
+        vecr get_glow(const uvr& uv, const uvr& dx, const uvr& dy) const;
+        real get_specular(const uvr& uv, const uvr& dx, const uvr& dy) const;
+        vecr get_normal_with_map(const uvr& uv, const uvr& dx, const uvr& dy) const;
+        // 对 n（不超过 Texture::batch）个片元批量采样模型拥有的全部贴图，没有的贴图对应的结果不写入
+        void sample_materials(const uvr* uv, const uvr* dx, const uvr* dy, int n, MaterialSamples& out) const;
 
         const TGAImage& get_diffusemap() const;
         const TGAImage& get_normalmap() const;
@@ -57,15 +97,19 @@ namespace MSRender{
         bool has_specular_map() const { return has_specularmap; }
         bool has_glow_map() const { return has_glowmap; }
 
-        mat4d model_matrix;
+        mat4r model_matrix;
         // 模型变换的逆矩阵的转置
-        mat4d normal_matrix;
+        mat4r normal_matrix;
         static bool nm_is_in_tangent;
+        // 为真时优先从 OBJ 旁的 .msrmesh 缓存加载，缓存缺失或过期时重新解析并写入缓存
+        static bool use_mesh_cache;
+        static TextureFilter texture_filter;
+        static TextureWrap texture_wrap;
 
         void set_model_matrix(const ModelTransfParam&);
         void set_normal_matrix();
-        pointd model_transf(pointd&& p) const;
-        vecd model_nm_transf(vecd&& nm) const;
+        pointr model_transf(pointr&& p) const;
+        vecr model_nm_transf(vecr&& nm) const;
     };
 }
 
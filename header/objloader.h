@@ -0,0 +1,30 @@
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+#include <string>
+#include <vector>
+#include "algebra.h"
+
+namespace MSRender {
+    class ThreadPool;
+
+    // OBJ 文件中的几何数据。属性按出现顺序保存；面在加载时已三角化，每三个角组成一个三角形，
+    // 每个角保存 0 起始的 (v, vt, vn) 下标，缺省的 vt、vn 为 -1。face_size 记录原文件中每个面的角数
+    struct ObjData {
+        std::vector<pointr> positions;
+        std::vector<uvr> uvs;
+        std::vector<vecr> normals;
+        std::vector<int> corner_v, corner_vt, corner_vn;
+        std::vector<int> face_size;
+        void clear();
+    };
+
+    // 解析内存中的 OBJ 文本，支持 v、vt、vn 与 f（v、v/t、v//n、v/t/n 以及负数下标），忽略其他语句。
+    // 多于三个角的面在拼接时三角化：凸多边形切成扇形，凹多边形用耳切法。
+    // 给出 pool 且文本足够大时，按行边界切成多段并行解析后拼接，结果与串行解析完全相同。
+    // 出错时返回 false，error 中写入行号与原因
+    bool parse_obj(const char* begin, const char* end, ObjData& out, std::string& error, ThreadPool* pool = nullptr);
+    // 把文件映射到内存后解析（不支持 mmap 的平台整体读入）
+    bool load_obj(const std::string& filename, ObjData& out, std::string& error, ThreadPool* pool = nullptr);
+}
+
+#endif
\ No newline at end of file
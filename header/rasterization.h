@@ -3,18 +3,120 @@
 #include "algebra.h"
 #include "tgaimage.h"
 #include "shader.h"
+#include "threadpool.h"
+#include "shadowmap.h"
+#include <atomic>
+#include <utility>
 
 namespace MSRender{
-    void rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, double* zbuffer, Light&, double* shadow_map=NULL);
-    void draw_zbuffer(double*, TGAImage&, TGAColor);
-    void shadow(Triangle& tri, double* shadow_map);
+    // 闭区间 [min_x, max_x] x [min_y, max_y]
+    struct bbox { int max_x, min_x, max_y, min_y; };
+
+    // 分层深度：记录每个 size x size 块内最远（最小）的深度，
+    // 三角形可能的最近深度不超过它时，整块都不会通过深度测试
+    struct HiZBuffer {
+        static constexpr int size = 8;
+        static constexpr int tiles_x = (W + size - 1) / size;
+        static constexpr int tiles_y = (H + size - 1) / size;
+        std::vector<real> far_depth;
+
+        explicit HiZBuffer(real depth) : far_depth(tiles_x * tiles_y, depth) {}
+        real& at(int tx, int ty) { return far_depth[tx + ty * tiles_x]; }
+        real at(int tx, int ty) const { return far_depth[tx + ty * tiles_x]; }
+        // 块 (tx, ty) 的深度被改写后，从 zbuffer 重新计算其最远深度
+        void update(const real* zbuffer, int tx, int ty);
+    };
+
+    // 延迟着色的几何缓冲：保存每个像素最终可见片元着色所需的属性
+    struct GSample {
+        pointr world_pos;
+        vecr normal;
+        uvr uv;
+        uvr duv_dx, duv_dy;   // uv 在所在 2x2 像素块内沿屏幕 x、y 的差分，用于选择 mip 层
+        pointr texture;   // 模型没有对应贴图时使用的顶点插值结果
+        real specular = 0;
+        int model = -1;   // -1 表示没有片元覆盖
+        int tri = -1;
+    };
+    using GBuffer = std::vector<GSample>;
+
+    // forward: 单遍前向渲染；zprepass: 先只写深度，再对深度相等的片元着色；deferred: 延迟着色
+    enum class RenderMode { forward, zprepass, deferred };
+
+    struct RenderStats {
+        std::atomic<size_t> vertices{0};         // 顶点着色器处理的顶点数
+        std::atomic<size_t> triangles{0};        // 进入图元剔除阶段的三角形数
+        std::atomic<size_t> culled_backface{0};
+        std::atomic<size_t> culled_frustum{0};
+        std::atomic<size_t> fragments{0};        // 通过深度测试的片元数
+        std::atomic<size_t> shading{0};          // PixelShader::shading 的调用次数
+    };
+
+    // 视锥剔除：三个顶点都在同一裁剪平面外侧时返回 true，在裁剪之前进行
+    bool cull_frustum(const Triangle& tri, RenderStats* stats=NULL);
+    // 背面剔除：三角形在屏幕空间背向相机时返回 true，在裁剪之后进行
+    bool cull_backface(const Triangle& tri, RenderStats* stats=NULL);
+
+    // 一帧的渲染目标
+    struct FrameContext {
+        TGAImage& image;
+        real* zbuffer;
+        HiZBuffer* hiz = NULL;
+        GBuffer* gbuffer = NULL;      // 仅延迟着色使用，大小为 W*H
+        RenderStats* stats = NULL;
+    };
+
+    // 按屏幕 tile 剔除光源：光源作用范围的球投影到屏幕上的包围盒与 tile 相交时，光源进入该 tile 的列表。
+    // 作用半径为无穷大或球与近平面相交的光源进入所有 tile
+    struct LightGrid {
+        static constexpr int tiles_x = (W + tile_size - 1) / tile_size;
+        static constexpr int tiles_y = (H + tile_size - 1) / tile_size;
+        std::vector<std::vector<std::uint32_t>> lists;
+
+        void build(const std::vector<Light>& lights, const VertexShader& vertex_shader);
+        const std::vector<std::uint32_t>& at(int x, int y) const { return lists[x / tile_size + y / tile_size * tiles_x]; }
+        // 每个 tile 平均的光源数
+        real average() const;
+    };
+
+    // 着色时的光照：所有光源、各光源的阴影贴图（不投射阴影的光源为空）与按 tile 剔除后的光源列表，
+    // lights 的下标须与 PixelShader 中的光源一致
+    struct Lighting {
+        const std::vector<Light>& lights;
+        std::vector<const CascadedShadowMap*> shadows;
+        const LightGrid* grid = NULL;     // 为空时每个片元遍历所有光源
+    };
+
+    // 返回通过深度测试并着色的片元数
+    size_t rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, real* zbuffer, const Lighting&, HiZBuffer* hiz=NULL);
+    // 只光栅化 tri 落在 region 内的像素，region.min_x 需要是 HiZBuffer::size 的倍数
+    size_t rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, real* zbuffer, const Lighting&, HiZBuffer* hiz, const bbox& region);
+    // 深度预处理：只写 zbuffer 与 HiZ，不插值属性也不着色
+    size_t rasterize_depth(Triangle& tri, real* zbuffer, HiZBuffer* hiz, const bbox& region);
+    // 深度预处理之后的着色遍：只对深度与 zbuffer 相等的片元着色，shaded 记录 region 内已着色的像素
+    size_t rasterize_equal(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, const real* zbuffer, const Lighting&,
+                           HiZBuffer* hiz, const bbox& region, std::vector<bool>& shaded);
+    // 延迟着色的几何阶段：通过深度测试的片元只写入 gbuffer，不着色
+    size_t rasterize_gbuffer(Triangle& tri, int tri_index, int model_index, const Model& model, GBuffer& gbuffer, real* zbuffer, HiZBuffer* hiz, const bbox& region);
+    // 延迟着色的着色阶段：region 内每个被覆盖的像素恰好着色一次，返回着色次数。
+    // tangents[i] 为第 i 个三角形的切线与副切线（没有切线空间法线贴图时不使用）
+    size_t shade_gbuffer(const GBuffer& gbuffer, const std::vector<std::pair<vecr, vecr>>& tangents, const std::vector<Model>& models, TGAImage& image,
+                         const PixelShader* shader, const Lighting&, const bbox& region);
+    // 将三角形按屏幕 tile 分组后并行光栅化，每个 tile 内保持提交顺序，结果与串行一致
+    void rasterize_tiled(const VertexBuffer& vertices, const std::vector<TriangleRef>& triangles, const std::vector<Model>& models,
+                         const PixelShader* shader, const Lighting&, FrameContext& frame, ThreadPool& pool,
+                         RenderMode mode = RenderMode::forward);
+    void draw_zbuffer(real*, TGAImage&, TGAColor);
+    // 把光源空间中的三角形 v[0..2]（x、y 为阴影贴图的像素坐标）写入深度缓冲中 region 范围内的像素，只保留更靠近光源的深度。
+    // depth 指向 region 左上角的像素，每行 stride 个元素；不同 region 可以并行
+    void shadow(const pointr* v, real* depth, int stride, const bbox& region);
 }
-// void get_shadow_zbuffer(MSRender::Fragment*, TGAImage&, double*);
+// void get_shadow_zbuffer(MSRender::Fragment*, TGAImage&, real*);
 
 // // get mvp
-// MSRender::mat4d model_transf(const double* scale, const double* thetas, const MSRender::vecd& translate);
-// MSRender::mat4d view_transf(const MSRender::pointd& eye, const MSRender::vecd& eye_up_dir, const MSRender::pointd& center);
-// MSRender::mat4d projection_transf(double eye_fov, double aspect_ratio, double z_near, double z_far);
-// MSRender::mat4d ortho_proj_transf(double r, double t, double n);
+// MSRender::mat4r model_transf(const real* scale, const real* thetas, const MSRender::vecr& translate);
+// MSRender::mat4r view_transf(const MSRender::pointr& eye, const MSRender::vecr& eye_up_dir, const MSRender::pointr& center);
+// MSRender::mat4r projection_transf(real eye_fov, real aspect_ratio, real z_near, real z_far);
+// MSRender::mat4r ortho_proj_transf(real r, real t, real n);
 
 #endif
\ No newline at end of file
@@ -5,19 +5,20 @@
 #include "tgaimage.h"
 #include "global.h"
 #include <iostream>
+#include <limits>
 
 namespace MSRender {
 
     struct Vertex {
-        pointd screen_pos;
-        pointd light_space_pos;
-        double w;
-        pointd world_pos;
-        vecd normal;
-        uvd uv;
-        pointd texture;
-        pointd glow;
-        double specular; // 黑白只有一个值
+        pointr clip_pos;     // 投影变换后、透视除法前的齐次坐标
+        pointr screen_pos;
+        real w;
+        pointr world_pos;
+        vecr normal;
+        uvr uv;
+        pointr texture;
+        pointr glow;
+        real specular; // 黑白只有一个值
     };
     using Fragment = Vertex;
 
@@ -27,22 +28,62 @@ namespace MSRender {
         Vertex& operator[](const size_t i) {return vertex[i];}
     };
 
+    // 以下标引用 VertexBuffer 中顶点的三角形
+    struct TriangleRef {
+        std::uint32_t v[3];
+        std::uint32_t model;
+    };
+
+    // 变换后的顶点，按属性分开存放（SoA）。光栅化用到的屏幕坐标与 w 使用管线精度 real，
+    // 其余插值属性用 float；材质的默认颜色不逐顶点保存，组装三角形时由模型补齐
+    struct VertexBuffer {
+        std::vector<real> sx, sy, sz, w;
+        std::vector<float> wx, wy, wz;
+        std::vector<float> nx, ny, nz;
+        std::vector<float> u, v;
+
+        size_t size() const { return sx.size(); }
+        size_t bytes() const;
+        void reserve(size_t n);
+        void resize(size_t n);
+        void set(std::uint32_t i, const Vertex&);
+        std::uint32_t push(const Vertex&);
+        Vertex get(std::uint32_t i, const Model& model) const;
+        Triangle triangle(const TriangleRef& ref, const Model& model) const;
+    };
+
+    // 批量顶点变换的结果，按分量分开存放；下标与模型中去重后的顶点一致
+    struct VertexBatch {
+        std::vector<real> cx, cy, cz, cw;   // 裁剪空间坐标
+        std::vector<real> sx, sy, sz, w;    // 屏幕坐标与 w
+        Vec3Stream world;
+        Vec3Stream normal;                  // 世界空间中归一化的法线
+
+        size_t size() const { return sx.size(); }
+        void resize(size_t n);
+        // 第 i 个顶点的变换结果，不含 uv、光源空间坐标与材质
+        Vertex get(size_t i) const;
+    };
+
     struct Light {
-        pointd pos;
-        double intensity;
+        pointr pos;
+        real intensity;
         TGAColor color;
-        Light(pointd pos_, double intensity_)
+        // 作用半径：超出该距离的片元不受此光源影响，衰减在接近半径处平滑降为 0；无穷大时按 1/r^2 衰减、照亮所有片元
+        real range = std::numeric_limits<real>::infinity();
+        Light(pointr pos_, real intensity_)
         : pos(pos_), intensity(intensity_), color(TGAColor(255, 255, 255)) {
             set_light_space_matrix(center, eye_up_dir, shadow_map_size);
         }
-        Light(pointd pos_, double intensity_, TGAColor c)
-        : pos(pos_), intensity(intensity_), color(c) {
+        Light(pointr pos_, real intensity_, TGAColor c, real range_ = std::numeric_limits<real>::infinity())
+        : pos(pos_), intensity(intensity_), color(c), range(range_) {
             set_light_space_matrix(center, eye_up_dir, shadow_map_size);
         }
 
-        mat4d light_space_matrix;
-        void set_light_space_matrix(vecd center, vecd up, double r);
-        pointd get_light_space(pointd p);
+        mat4r view_matrix;         // 世界空间到光源视空间，光源看向 -z
+        mat4r light_space_matrix;  // 世界空间到光源 NDC，单张阴影贴图使用
+        void set_light_space_matrix(vecr center, vecr up, real r);
+        pointr get_light_space(pointr p);
     };
 
     class PixelShader {
@@ -52,33 +93,51 @@ namespace MSRender {
         virtual ~PixelShader() = default;
         PixelShader(std::vector<Light> ls)
         : lights(ls) {}
-        virtual TGAColor shading(const Fragment&, double shadow=1.) const = 0;
+        // 只计算下标在 ids 中的 n 个光源，shadow[i] 为第 i 个光源的阴影系数（完全受光为 1），
+        // ambient_shadow 为环境光与自发光的阴影系数
+        virtual TGAColor shading(const Fragment&, const std::uint32_t* ids, const real* shadow, int n, real ambient_shadow) const = 0;
     };
 
     class PhongShader: public PixelShader {
         const int p;
-        double ka; // 全局光照系数
-        // double ks; // 镜面反射系数
+        real ka; // 全局光照系数
+        // real ks; // 镜面反射系数
         // TGAColor kd; // 漫反射系数，texture
     public:
         ~PhongShader() = default;
-        PhongShader(std::vector<Light> ls, int _p=512, double ka_=0.5/*, double ks_=0.7*/)
+        PhongShader(std::vector<Light> ls, int _p=512, real ka_=0.5/*, real ks_=0.7*/)
         : PixelShader(ls), p(_p), ka(ka_)/*, ks(ks_)*/ {}
-        TGAColor shading(const Fragment& fragment, double shadow=1.) const override ;
+        TGAColor shading(const Fragment& fragment, const std::uint32_t* ids, const real* shadow, int n, real ambient_shadow) const override ;
     };
 
+    // 对裁剪空间中的三角形做 Sutherland-Hodgman 裁剪（透视除法之前），结果三角化后写入 out，返回三角形个数。
+    // 总是裁剪近、远平面；clip_sides 为假时，只有顶点超出保护带才裁剪上下左右四个平面
+    constexpr int max_clipped_triangles = 7;
+    int clip_triangle(const Triangle& tri, Triangle* out, bool clip_sides=false);
+    // 返回 tri 需要裁剪的平面（位掩码），为 0 时不需要裁剪
+    unsigned clip_planes(const Triangle& tri, bool clip_sides=false);
+
     class VertexShader {
-        mat4d projection_matrix;
-        mat4d view_matrix;
-        mat4d vp;
-        void set_view_matrix(const pointd& eye, const vecd& eye_up_dir, const pointd& center);
-        void set_projection_matrix(double eye_fov, double aspect_ratio, double z_near, double z_far);
+        mat4r projection_matrix;
+        mat4r view_matrix;
+        mat4r vp;
+        void set_view_matrix(const pointr& eye, const vecr& eye_up_dir, const pointr& center);
+        void set_projection_matrix(real eye_fov, real aspect_ratio, real z_near, real z_far);
     public:
         VertexShader();
         ~VertexShader() = default;
+        const mat4r& view_projection() const { return vp; }
 
         // mvp 变换 + 视口变换
         Vertex shading(const Model&, const size_t, const size_t);
+        // 对模型中下标为 index 的（去重后的）顶点做变换
+        Vertex shading(const Model&, const size_t index);
+        // 批量变换模型中 [begin, end) 的顶点，结果写入 out 的相同下标处，out 需要预先 resize
+        void shading(const Model&, size_t begin, size_t end, VertexBatch& out) const;
+        // 由 clip_pos 做透视除法与视口变换，得到 screen_pos 与 w
+        static void viewport(Vertex&);
+        // 模型没有对应贴图时顶点使用的默认材质
+        static void material(const Model&, Vertex&);
     };
 }
 
@@ -0,0 +1,110 @@
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "algebra.h"
+#include "tgaimage.h"
+
+namespace MSRender {
+    class ThreadPool;
+    struct Light;
+
+    // float32: 直接保存光源空间的深度；depth16: NDC 深度在 [-1, 1] 内线性量化为 16 位，0 表示没有遮挡物
+    enum class ShadowFormat { float32, depth16 };
+
+    // hard: 单次比较；pcf3x3 / pcf5x5: 规则网格上的百分比渐近过滤；poisson16 / poisson32: 泊松圆盘采样；
+    // pcss: 先在泊松圆盘内搜索遮挡物，按平均遮挡深度估计半影宽度，再用该半径做 poisson32
+    enum class ShadowFilter { hard, pcf3x3, pcf5x5, poisson16, poisson32, pcss };
+
+    struct ShadowKernel;
+
+    // 正方形的阴影贴图，分辨率与输出图像无关。深度为光源正交投影后的 z，越大越靠近光源
+    class ShadowMap {
+        int size_ = 0;
+        ShadowFormat format_ = ShadowFormat::float32;
+        std::vector<float> depth32;
+        std::vector<std::uint16_t> depth16;
+
+        // 以纹素坐标 (x, y) 为中心、按 scale 缩放的各采样点中深度大于 ref 的个数，sum 非空时累加这些遮挡物的深度
+        int occluders(const ShadowKernel& kernel, real x, real y, real scale, real ref, real* sum) const;
+    public:
+        // 绘制时按 tile x tile 的块分桶并行光栅化
+        static constexpr int tile = 64;
+        // 所有阴影贴图共用的过滤方式；泊松圆盘的半径（纹素）；pcss 中光源张角的正切，决定半影宽度
+        static ShadowFilter filter;
+        static real filter_radius;
+        static real light_size;
+
+        ShadowMap() = default;
+        ShadowMap(int size, ShadowFormat format = ShadowFormat::float32);
+
+        int size() const { return size_; }
+        int tiles() const { return (size_ + tile - 1) / tile; }
+        ShadowFormat format() const { return format_; }
+        size_t bytes() const { return (size_t)size_ * size_ * (format_ == ShadowFormat::float32 ? sizeof(float) : sizeof(std::uint16_t)); }
+        void clear();
+
+        // 光源空间的 NDC 坐标换算为贴图的像素坐标，z 不变
+        pointr to_texel(const pointr& ndc) const {
+            return pointr((ndc.x + 1) * size_ * 0.5, (ndc.y + 1) * size_ * 0.5, ndc.z, 1);
+        }
+        // 像素 (x, y) 处最靠近光源的深度，越界或没有遮挡物时返回 -inf
+        real depth(int x, int y) const;
+        // NDC 坐标 (x, y) 所在像素的深度
+        real lookup(real ndc_x, real ndc_y) const {
+            // 向下取整，略小于 0 的坐标落在贴图外而不是第 0 个像素
+            return depth((int)std::floor((ndc_x + 1) * size_ * 0.5), (int)std::floor((ndc_y + 1) * size_ * 0.5));
+        }
+        // 光源空间 NDC 坐标处未被遮挡的比例：1 为完全受光，0 为完全在阴影中。深度减去 bias 后仍大于 ndc.z 的采样点算作遮挡，
+        // 支持 AVX2 时每 8 个采样点一起用 gather 读取与比较
+        real visibility(const pointr& ndc, real bias) const;
+
+        // corners 中每三个点组成一个三角形，坐标已由 to_texel 换算。按块分桶后并行光栅化，
+        // 每块先写入块内的 real 深度缓冲，完成后再按存储格式写回，重新绘制前不需要 clear
+        void render(const std::vector<pointr>& corners, ThreadPool& pool);
+        // render 的两步：bin 返回每块（tiles() * tiles() 个，按行排列）覆盖的三角形，render_tile 绘制第 t 块，不同块可并行
+        std::vector<std::vector<int>> bin(const std::vector<pointr>& corners) const;
+        void render_tile(const std::vector<pointr>& corners, const std::vector<int>& bin, int t);
+        // 把深度归一化后画成灰度图，放在 image 中横坐标 x0 开始的位置，image 的高度须与贴图相同
+        void draw(TGAImage& image, TGAColor color, int x0 = 0) const;
+    };
+
+    // 级联阴影贴图：把相机视锥按深度分成若干段，每段用一个贴合该段（与场景范围求交）的光源正交投影绘制一张阴影贴图，
+    // 着色时按片元到相机的深度选择所在的段。没有分段时退化为使用 Light::light_space_matrix 的单张贴图
+    class CascadedShadowMap {
+        std::vector<ShadowMap> maps;
+        std::vector<mat4r> matrices;     // 世界空间到各段光源 NDC 的变换
+        std::vector<real> splits;        // 各段远端到相机的深度
+        std::vector<real> depth_scales;  // 各段单位世界长度对应的 NDC 深度
+        pointr eye;
+        vecr forward;
+        bool fixed = false;
+    public:
+        // 分段位置在均匀分段与对数分段之间插值，split_lambda 为对数分段的权重
+        static real split_lambda;
+
+        CascadedShadowMap() = default;
+        // cascades 为 0 时只用一张贴图，投影固定为 Light::light_space_matrix
+        CascadedShadowMap(int cascades, int size, ShadowFormat format = ShadowFormat::float32);
+
+        int cascades() const { return maps.size(); }
+        const ShadowMap& map(int c) const { return maps[c]; }
+        real split(int c) const { return splits[c]; }
+        size_t bytes() const;
+
+        // 按光源与全局的相机参数确定各段的投影。world_corners 中每三个点组成一个三角形，用于求场景范围，
+        // 各段的深度范围覆盖整个场景，使段外的遮挡物也能投下阴影
+        void fit(const Light& light, const std::vector<pointr>& world_corners);
+        // 各段的所有块一起并行光栅化
+        void render(const std::vector<pointr>& world_corners, ThreadPool& pool);
+        // 同时绘制多个光源的阴影贴图，所有贴图各段的块放在同一个任务列表中并行
+        static void render_all(const std::vector<CascadedShadowMap*>& shadows, const std::vector<pointr>& world_corners, ThreadPool& pool);
+        // 世界坐标处未被遮挡的比例，bias 为世界空间中的深度偏移
+        real visibility(const pointr& world_pos, real bias) const;
+        // 各段的深度图从左到右排列，image 的尺寸须为 (size * cascades, size)
+        void draw(TGAImage& image, TGAColor color) const;
+    };
+}
+
+#endif
\ No newline at end of file
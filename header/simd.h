@@ -0,0 +1,256 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+// 4x4 矩阵运算的 SIMD 内核，按编译选项选择 AVX / SSE2 / NEON / 标量实现。
+// 矩阵按行连续存放 16 个元素；各实现的求和顺序都是 (p0 + p1) + (p2 + p3)，结果逐位一致
+#include <cmath>
+#include <cstddef>
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MSR_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define MSR_SIMD_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MSR_SIMD_NEON
+#endif
+
+namespace MSRender {
+namespace simd {
+    // out[i] = dot(m 的第 i 行, v)
+    template<typename T>
+    inline void mat4_mul_vec4(const T* m, const T* v, T* out) {
+        T r[4];
+        for(int i = 0; i < 4; i++)
+            r[i] = (m[i*4] * v[0] + m[i*4+1] * v[1]) + (m[i*4+2] * v[2] + m[i*4+3] * v[3]);
+        for(int i = 0; i < 4; i++) out[i] = r[i];
+    }
+
+    // out 的第 i 行 = sum_k a[i][k] * (b 的第 k 行)
+    template<typename T>
+    inline void mat4_mul_mat4(const T* a, const T* b, T* out) {
+        T r[16];
+        for(int i = 0; i < 4; i++)
+            for(int j = 0; j < 4; j++)
+                r[i*4+j] = (a[i*4] * b[j] + a[i*4+1] * b[4+j]) + (a[i*4+2] * b[8+j] + a[i*4+3] * b[12+j]);
+        for(int i = 0; i < 16; i++) out[i] = r[i];
+    }
+
+    // 按分量分开存放（SoA）的一批点同时乘以矩阵：第 r 行的结果
+    // out[r][i] = (m[r][0] * x[i] + m[r][1] * y[i]) + (m[r][2] * z[i] + m[r][3] * w)，r < rows
+    // 标量实现同时处理 SIMD 版本剩下的尾部
+    template<typename T>
+    inline void mat4_mul_points_scalar(const T* m, const T* x, const T* y, const T* z, T w, size_t begin, size_t n, T* const* out, int rows) {
+        for(int r = 0; r < rows; r++) {
+            const T m0 = m[r*4], m1 = m[r*4+1], m2 = m[r*4+2], mw = m[r*4+3] * w;
+            T* o = out[r];
+            for(size_t i = begin; i < n; i++) o[i] = (m0 * x[i] + m1 * y[i]) + (m2 * z[i] + mw);
+        }
+    }
+
+    template<typename T>
+    inline void mat4_mul_points(const T* m, const T* x, const T* y, const T* z, T w, size_t n, T* const* out, int rows) {
+        mat4_mul_points_scalar(m, x, y, z, w, 0, n, out, rows);
+    }
+
+    // 把 n 个三维向量就地归一化
+    template<typename T>
+    inline void normalize3_scalar(T* x, T* y, T* z, size_t begin, size_t n) {
+        for(size_t i = begin; i < n; i++) {
+            T len = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+            x[i] /= len, y[i] /= len, z[i] /= len;
+        }
+    }
+
+    template<typename T>
+    inline void normalize3(T* x, T* y, T* z, size_t n) {
+        normalize3_scalar(x, y, z, 0, n);
+    }
+
+#if defined(MSR_SIMD_AVX)
+    template<>
+    inline void mat4_mul_vec4<double>(const double* m, const double* v, double* out) {
+        // 先把四行转置成四列，再用广播的分量与各列相乘累加，避免水平求和
+        __m256d r0 = _mm256_loadu_pd(m), r1 = _mm256_loadu_pd(m + 4);
+        __m256d r2 = _mm256_loadu_pd(m + 8), r3 = _mm256_loadu_pd(m + 12);
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+        __m256d c0 = _mm256_permute2f128_pd(t0, t2, 0x20), c1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+        __m256d c2 = _mm256_permute2f128_pd(t0, t2, 0x31), c3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+        __m256d s01 = _mm256_add_pd(_mm256_mul_pd(c0, _mm256_set1_pd(v[0])), _mm256_mul_pd(c1, _mm256_set1_pd(v[1])));
+        __m256d s23 = _mm256_add_pd(_mm256_mul_pd(c2, _mm256_set1_pd(v[2])), _mm256_mul_pd(c3, _mm256_set1_pd(v[3])));
+        _mm256_storeu_pd(out, _mm256_add_pd(s01, s23));
+    }
+
+    template<>
+    inline void mat4_mul_mat4<double>(const double* a, const double* b, double* out) {
+        __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+        __m256d b2 = _mm256_loadu_pd(b + 8), b3 = _mm256_loadu_pd(b + 12);
+        __m256d r[4];
+        for(int i = 0; i < 4; i++) {
+            __m256d s01 = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(a[i*4]), b0), _mm256_mul_pd(_mm256_set1_pd(a[i*4+1]), b1));
+            __m256d s23 = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(a[i*4+2]), b2), _mm256_mul_pd(_mm256_set1_pd(a[i*4+3]), b3));
+            r[i] = _mm256_add_pd(s01, s23);
+        }
+        for(int i = 0; i < 4; i++) _mm256_storeu_pd(out + i*4, r[i]);
+    }
+#endif
+
+#if defined(MSR_SIMD_SSE2)
+    template<>
+    inline void mat4_mul_vec4<double>(const double* m, const double* v, double* out) {
+        __m128d x0 = _mm_loadu_pd(v), x1 = _mm_loadu_pd(v + 2);
+        __m128d r[2];
+        for(int i = 0; i < 2; i++) {
+            const double* r0 = m + i*8;
+            const double* r1 = r0 + 4;
+            __m128d a0 = _mm_mul_pd(_mm_loadu_pd(r0), x0), b0 = _mm_mul_pd(_mm_loadu_pd(r0 + 2), x1);
+            __m128d a1 = _mm_mul_pd(_mm_loadu_pd(r1), x0), b1 = _mm_mul_pd(_mm_loadu_pd(r1 + 2), x1);
+            __m128d s = _mm_add_pd(_mm_unpacklo_pd(a0, a1), _mm_unpackhi_pd(a0, a1));
+            __m128d t = _mm_add_pd(_mm_unpacklo_pd(b0, b1), _mm_unpackhi_pd(b0, b1));
+            r[i] = _mm_add_pd(s, t);
+        }
+        _mm_storeu_pd(out, r[0]);
+        _mm_storeu_pd(out + 2, r[1]);
+    }
+
+    template<>
+    inline void mat4_mul_mat4<double>(const double* a, const double* b, double* out) {
+        double r[16];
+        for(int i = 0; i < 4; i++) {
+            for(int h = 0; h < 4; h += 2) {
+                __m128d s01 = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(a[i*4]), _mm_loadu_pd(b + h)),
+                                         _mm_mul_pd(_mm_set1_pd(a[i*4+1]), _mm_loadu_pd(b + 4 + h)));
+                __m128d s23 = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(a[i*4+2]), _mm_loadu_pd(b + 8 + h)),
+                                         _mm_mul_pd(_mm_set1_pd(a[i*4+3]), _mm_loadu_pd(b + 12 + h)));
+                _mm_storeu_pd(r + i*4 + h, _mm_add_pd(s01, s23));
+            }
+        }
+        for(int i = 0; i < 16; i++) out[i] = r[i];
+    }
+#endif
+
+#if defined(MSR_SIMD_AVX) || defined(MSR_SIMD_SSE2)
+    template<>
+    inline void mat4_mul_vec4<float>(const float* m, const float* v, float* out) {
+        __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4);
+        __m128 c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        __m128 s01 = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v[0])), _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+        __m128 s23 = _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(v[2])), _mm_mul_ps(c3, _mm_set1_ps(v[3])));
+        _mm_storeu_ps(out, _mm_add_ps(s01, s23));
+    }
+
+    template<>
+    inline void mat4_mul_mat4<float>(const float* a, const float* b, float* out) {
+        __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4);
+        __m128 b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+        __m128 r[4];
+        for(int i = 0; i < 4; i++) {
+            __m128 s01 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i*4]), b0), _mm_mul_ps(_mm_set1_ps(a[i*4+1]), b1));
+            __m128 s23 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i*4+2]), b2), _mm_mul_ps(_mm_set1_ps(a[i*4+3]), b3));
+            r[i] = _mm_add_ps(s01, s23);
+        }
+        for(int i = 0; i < 4; i++) _mm_storeu_ps(out + i*4, r[i]);
+    }
+#endif
+
+#if defined(MSR_SIMD_AVX)
+    // 批量变换一次处理 4 个 double 或 8 个 float，不足一组的尾部走标量版本
+    template<>
+    inline void mat4_mul_points<double>(const double* m, const double* x, const double* y, const double* z, double w, size_t n, double* const* out, int rows) {
+        size_t body = n & ~size_t(3);
+        for(int r = 0; r < rows; r++) {
+            __m256d m0 = _mm256_set1_pd(m[r*4]), m1 = _mm256_set1_pd(m[r*4+1]);
+            __m256d m2 = _mm256_set1_pd(m[r*4+2]), mw = _mm256_set1_pd(m[r*4+3] * w);
+            double* o = out[r];
+            for(size_t i = 0; i < body; i += 4) {
+                __m256d s01 = _mm256_add_pd(_mm256_mul_pd(m0, _mm256_loadu_pd(x + i)), _mm256_mul_pd(m1, _mm256_loadu_pd(y + i)));
+                __m256d s2w = _mm256_add_pd(_mm256_mul_pd(m2, _mm256_loadu_pd(z + i)), mw);
+                _mm256_storeu_pd(o + i, _mm256_add_pd(s01, s2w));
+            }
+        }
+        mat4_mul_points_scalar(m, x, y, z, w, body, n, out, rows);
+    }
+
+    template<>
+    inline void mat4_mul_points<float>(const float* m, const float* x, const float* y, const float* z, float w, size_t n, float* const* out, int rows) {
+        size_t body = n & ~size_t(7);
+        for(int r = 0; r < rows; r++) {
+            __m256 m0 = _mm256_set1_ps(m[r*4]), m1 = _mm256_set1_ps(m[r*4+1]);
+            __m256 m2 = _mm256_set1_ps(m[r*4+2]), mw = _mm256_set1_ps(m[r*4+3] * w);
+            float* o = out[r];
+            for(size_t i = 0; i < body; i += 8) {
+                __m256 s01 = _mm256_add_ps(_mm256_mul_ps(m0, _mm256_loadu_ps(x + i)), _mm256_mul_ps(m1, _mm256_loadu_ps(y + i)));
+                __m256 s2w = _mm256_add_ps(_mm256_mul_ps(m2, _mm256_loadu_ps(z + i)), mw);
+                _mm256_storeu_ps(o + i, _mm256_add_ps(s01, s2w));
+            }
+        }
+        mat4_mul_points_scalar(m, x, y, z, w, body, n, out, rows);
+    }
+
+    template<>
+    inline void normalize3<double>(double* x, double* y, double* z, size_t n) {
+        size_t body = n & ~size_t(3);
+        for(size_t i = 0; i < body; i += 4) {
+            __m256d vx = _mm256_loadu_pd(x + i), vy = _mm256_loadu_pd(y + i), vz = _mm256_loadu_pd(z + i);
+            __m256d len = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)), _mm256_mul_pd(vz, vz)));
+            _mm256_storeu_pd(x + i, _mm256_div_pd(vx, len));
+            _mm256_storeu_pd(y + i, _mm256_div_pd(vy, len));
+            _mm256_storeu_pd(z + i, _mm256_div_pd(vz, len));
+        }
+        normalize3_scalar(x, y, z, body, n);
+    }
+
+    template<>
+    inline void normalize3<float>(float* x, float* y, float* z, size_t n) {
+        size_t body = n & ~size_t(7);
+        for(size_t i = 0; i < body; i += 8) {
+            __m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+            __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+            _mm256_storeu_ps(x + i, _mm256_div_ps(vx, len));
+            _mm256_storeu_ps(y + i, _mm256_div_ps(vy, len));
+            _mm256_storeu_ps(z + i, _mm256_div_ps(vz, len));
+        }
+        normalize3_scalar(x, y, z, body, n);
+    }
+#endif
+
+#if defined(MSR_SIMD_NEON)
+    template<>
+    inline void mat4_mul_vec4<double>(const double* m, const double* v, double* out) {
+        float64x2_t x0 = vld1q_f64(v), x1 = vld1q_f64(v + 2);
+        for(int i = 0; i < 2; i++) {
+            const double* r0 = m + i*8;
+            const double* r1 = r0 + 4;
+            float64x2_t s = vpaddq_f64(vmulq_f64(vld1q_f64(r0), x0), vmulq_f64(vld1q_f64(r1), x0));
+            float64x2_t t = vpaddq_f64(vmulq_f64(vld1q_f64(r0 + 2), x1), vmulq_f64(vld1q_f64(r1 + 2), x1));
+            vst1q_f64(out + i*2, vaddq_f64(s, t));
+        }
+    }
+
+    template<>
+    inline void mat4_mul_vec4<float>(const float* m, const float* v, float* out) {
+        float32x4_t x = vld1q_f32(v);
+        float32x4_t p01 = vpaddq_f32(vmulq_f32(vld1q_f32(m), x), vmulq_f32(vld1q_f32(m + 4), x));
+        float32x4_t p23 = vpaddq_f32(vmulq_f32(vld1q_f32(m + 8), x), vmulq_f32(vld1q_f32(m + 12), x));
+        vst1q_f32(out, vpaddq_f32(p01, p23));
+    }
+
+    template<>
+    inline void mat4_mul_mat4<float>(const float* a, const float* b, float* out) {
+        float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b + 4), b2 = vld1q_f32(b + 8), b3 = vld1q_f32(b + 12);
+        float32x4_t r[4];
+        for(int i = 0; i < 4; i++) {
+            float32x4_t s01 = vaddq_f32(vmulq_n_f32(b0, a[i*4]), vmulq_n_f32(b1, a[i*4+1]));
+            float32x4_t s23 = vaddq_f32(vmulq_n_f32(b2, a[i*4+2]), vmulq_n_f32(b3, a[i*4+3]));
+            r[i] = vaddq_f32(s01, s23);
+        }
+        for(int i = 0; i < 4; i++) vst1q_f32(out + i*4, r[i]);
+    }
+#endif
+}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+#include <cstdint>
+#include <vector>
+#include "algebra.h"
+#include "tgaimage.h"
+
+namespace MSRender {
+    // nearest: 第 0 层最近邻，与直接读 TGAImage 相同；bilinear: 按 LOD 取最近的一层做双线性；
+    // trilinear: 相邻两层各做双线性后按 LOD 的小数部分混合
+    enum class TextureFilter { nearest, bilinear, trilinear };
+
+    // 过滤采样时超出 [0, 1] 的坐标：clamp 取边缘纹素，repeat 平铺
+    enum class TextureWrap { clamp, repeat };
+
+    // linear: 按行存放；tiled: 每 4x4 个纹素（64 字节，正好一条缓存行）连续存放，块之间按行排列，
+    // 双线性的 2x2 足迹以及沿纵向移动的采样大多落在同一条缓存行内
+    enum class TextureLayout { linear, tiled };
+
+    // 带 mip 链的纹理。每个纹素打包为 32 位，第 c 个字节为 TGAColor 的第 c 个通道（BGRA，灰度图只有第 0 个通道），
+    // 第 l+1 层由第 l 层按 2x2 盒式滤波缩小得到，奇数尺寸时最后一行（列）并入前一个纹素。
+    // 各层依次放在同一块内存中，批量采样时不同的通道可以用一次 gather 读取不同的层
+    class Texture {
+    public:
+        static constexpr int tile_bits = 2;
+        static constexpr int tile = 1 << tile_bits;
+        // 一次批量采样的最大个数
+        static constexpr int batch = 8;
+    private:
+        struct Level {
+            int width = 0, height = 0;
+            int tiles_x = 0;   // tiled 时每行的块数
+            int base = 0;      // 该层第一个纹素在 texels 中的下标
+        };
+        std::vector<Level> levels;
+        std::vector<std::uint32_t> texels;   // tiled 时各层宽高补齐到 tile 的倍数
+        // 按层存放的尺寸，供 SIMD gather 使用
+        std::vector<int> widths, heights, tiles_xs, bases;
+        TextureLayout layout_ = TextureLayout::tiled;
+
+        // 纹素的下标可以拆成只与 x、只与 y 有关的两部分之和，双线性采样时两个方向各算两次即可
+        size_t x_offset(const Level&, int x) const {
+            if(layout_ == TextureLayout::linear) return x;
+            return (size_t)(x >> tile_bits) << (2 * tile_bits) | (x & (tile - 1));
+        }
+        size_t y_offset(const Level& l, int y) const {
+            if(layout_ == TextureLayout::linear) return (size_t)y * l.width;
+            return ((size_t)(y >> tile_bits) * l.tiles_x << (2 * tile_bits)) | (size_t)(y & (tile - 1)) << tile_bits;
+        }
+        size_t offset(const Level& l, int x, int y) const { return l.base + x_offset(l, x) + y_offset(l, y); }
+        Level& add_level(int w, int h);
+        void bilinear_scalar(const float* u, const float* v, const int* level, int begin, int n, TextureWrap wrap, float (*out)[batch]) const;
+    public:
+        Texture() = default;
+        // 从已经翻转好的贴图生成完整的 mip 链
+        explicit Texture(TGAImage& img, TextureLayout layout = TextureLayout::tiled);
+
+        bool empty() const { return levels.empty(); }
+        TextureLayout layout() const { return layout_; }
+        int level_count() const { return (int)levels.size(); }
+        int width(int level = 0) const { return levels[level].width; }
+        int height(int level = 0) const { return levels[level].height; }
+
+        // 第 level 层 (x, y) 处打包的纹素，坐标须在范围内
+        std::uint32_t texel(int x, int y, int level = 0) const { return texels[offset(levels[level], x, y)]; }
+        static vecr unpack(std::uint32_t t) {
+            return vecr(t & 255, t >> 8 & 255, t >> 16 & 255, t >> 24);
+        }
+
+        // 第 0 层最近邻，等价于 TGAImage::get(u*width, v*height)，超出范围返回 0
+        std::uint32_t fetch_packed(real u, real v) const;
+        vecr fetch(real u, real v) const { return unpack(fetch_packed(u, v)); }
+        // dx、dy 为屏幕上沿 x、y 方向相邻一个像素时 uv 的变化量，返回 log2(纹素跨度)，未截断
+        real lod(const uvr& dx, const uvr& dy) const;
+
+        // 批量双线性：第 i 个坐标在第 level[i] 层采样，结果按通道写入 out[c][i]（BGRA，范围 [0, 255]），n 不超过 batch。
+        // 支持 AVX2 时 8 个坐标一起计算，纹素用 gather 读取；其余情况逐个计算，结果相同
+        void sample_bilinear(const float* u, const float* v, const int* level, int n, TextureWrap wrap, float (*out)[batch]) const;
+        // 批量过滤采样，lod 为 lod() 的结果；filter 为 nearest 时逐个调用 fetch
+        void sample(const float* u, const float* v, const float* lod, int n, TextureFilter filter, TextureWrap wrap, float (*out)[batch]) const;
+        // 单个坐标的过滤采样，与批量采样的结果相同
+        vecr sample(const uvr& uv, const uvr& dx, const uvr& dy, TextureFilter filter, TextureWrap wrap = TextureWrap::clamp) const;
+    };
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+namespace MSRender {
+    // 固定数量的工作线程，parallel_for 时调用线程也参与执行。
+    // 下标按连续区间平均分给每个参与线程，线程先从自己区间的前端取任务，
+    // 取完后从其他线程区间的后半段窃取，负载不均时也能保持各线程忙碌
+    class ThreadPool {
+        struct alignas(64) Range {
+            std::mutex mtx;
+            size_t begin = 0, end = 0;
+        };
+        std::vector<std::thread> workers;
+        std::unique_ptr<Range[]> ranges;  // 下标 0 属于调用 parallel_for 的线程
+        std::mutex mtx;
+        std::condition_variable wake_cv;
+        std::condition_variable done_cv;
+        const std::function<void(size_t)>* job = nullptr;
+        size_t busy = 0;
+        size_t generation = 0;
+        bool stop = false;
+
+        void worker_loop(size_t slot);
+        void run_job(size_t slot);
+        bool pop(size_t slot, size_t& index);
+        bool steal(size_t slot, size_t& index);
+    public:
+        explicit ThreadPool(size_t thread_num);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return workers.size() + 1; }
+        // 对 [0, n) 中每个下标调用一次 f，返回时全部完成。在任务内部嵌套调用时直接串行执行
+        void parallel_for(size_t n, const std::function<void(size_t)>& f);
+    };
+}
+
+#endif
\ No newline at end of file
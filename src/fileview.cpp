@@ -0,0 +1,51 @@
+#include "fileview.h"
+#include <fstream>
+#if defined(_WIN32)
+#define MSR_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace MSRender;
+
+FileView::~FileView() {
+#if !defined(MSR_NO_MMAP)
+    if(map) munmap(map, size_);
+#endif
+}
+
+bool FileView::open(const std::string& filename) {
+#if defined(MSR_NO_MMAP)
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if(!in) return false;
+    buffer.resize((size_t)in.tellg());
+    in.seekg(0);
+    if(!in.read(&buffer[0], buffer.size())) return false;
+    data_ = buffer.data(), size_ = buffer.size();
+    return true;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    if(size_ > 0) {
+        map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) map = nullptr;
+        else madvise(map, size_, MADV_WILLNEED);
+    }
+    ::close(fd);
+    if(size_ > 0 && !map) {
+        size_ = 0;
+        return false;
+    }
+    data_ = (const char*)map;
+    return true;
+#endif
+}
\ No newline at end of file
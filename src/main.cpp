@@ -3,16 +3,71 @@
 #include "model.h"
 #include "shader.h"
 #include "rasterization.h"
+#include "threadpool.h"
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
 
 static TGAImage image(W, H, TGAImage::RGB);
-static TGAImage z_image(W, H, TGAImage::RGB);
-static double zbuffer[W*H+1];
-static double shadow_map[W*H+1];
+static MSRender::real zbuffer[W*H+1];
+static MSRender::HiZBuffer hiz(-z_far-1);
 
-int main() {
+int main(int argc, char** argv) {
+    // -t N 指定光栅化线程数，默认使用全部硬件线程
+    // -m forward|zprepass|deferred 选择渲染方式
+    // -c 0 关闭二进制网格缓存，每次都解析 OBJ 与 TGA
+    // -f nearest|bilinear|trilinear 选择贴图过滤方式，默认 trilinear
+    // -w clamp|repeat 过滤采样时超出 [0, 1] 的纹理坐标的处理方式，默认 clamp
+    // -s N 阴影贴图的边长，默认 2048；-z 32|16 阴影贴图每个深度的位数，默认 32
+    // -p hard|pcf3x3|pcf5x5|poisson16|poisson32|pcss 阴影过滤方式，默认 hard
+    // -k N 级联阴影贴图的段数，默认 0 即使用光源固定投影的单张贴图
+    // -l N 在地板上方额外放置 N 个作用半径有限的彩色点光源；-L N 前 N 个光源投射阴影，默认 1
+    // -g 0 关闭按 tile 的光源剔除，每个片元遍历所有光源
+    size_t thread_num = std::thread::hardware_concurrency();
+    MSRender::RenderMode mode = MSRender::RenderMode::forward;
+    int shadow_size = 2048, cascades = 0, extra_lights = 0;
+    size_t shadow_lights = 1;
+    bool light_culling = true;
+    MSRender::ShadowFormat shadow_format = MSRender::ShadowFormat::float32;
+    for(int i = 1; i + 1 < argc; i++) {
+        if(!std::strcmp(argv[i], "-t")) thread_num = std::strtoul(argv[++i], nullptr, 10);
+        else if(!std::strcmp(argv[i], "-m")) {
+            i++;
+            if(!std::strcmp(argv[i], "deferred")) mode = MSRender::RenderMode::deferred;
+            else if(!std::strcmp(argv[i], "zprepass")) mode = MSRender::RenderMode::zprepass;
+            else if(std::strcmp(argv[i], "forward")) std::cerr << "unknown render mode " << argv[i] << "\n";
+        }
+        else if(!std::strcmp(argv[i], "-c")) MSRender::Model::use_mesh_cache = std::strcmp(argv[++i], "0");
+        else if(!std::strcmp(argv[i], "-f")) {
+            i++;
+            if(!std::strcmp(argv[i], "nearest")) MSRender::Model::texture_filter = MSRender::TextureFilter::nearest;
+            else if(!std::strcmp(argv[i], "bilinear")) MSRender::Model::texture_filter = MSRender::TextureFilter::bilinear;
+            else if(std::strcmp(argv[i], "trilinear")) std::cerr << "unknown texture filter " << argv[i] << "\n";
+        }
+        else if(!std::strcmp(argv[i], "-s")) shadow_size = std::max(1, std::atoi(argv[++i]));
+        else if(!std::strcmp(argv[i], "-l")) extra_lights = std::max(0, std::atoi(argv[++i]));
+        else if(!std::strcmp(argv[i], "-g")) light_culling = std::strcmp(argv[++i], "0");
+        else if(!std::strcmp(argv[i], "-L")) shadow_lights = std::strtoul(argv[++i], nullptr, 10);
+        else if(!std::strcmp(argv[i], "-k")) cascades = std::max(0, std::atoi(argv[++i]));
+        else if(!std::strcmp(argv[i], "-z")) shadow_format = std::atoi(argv[++i]) == 16 ? MSRender::ShadowFormat::depth16 : MSRender::ShadowFormat::float32;
+        else if(!std::strcmp(argv[i], "-p")) {
+            i++;
+            const char* names[] = {"hard", "pcf3x3", "pcf5x5", "poisson16", "poisson32", "pcss"};
+            auto it = std::find_if(std::begin(names), std::end(names), [&](const char* name) { return !std::strcmp(argv[i], name); });
+            if(it != std::end(names)) MSRender::ShadowMap::filter = (MSRender::ShadowFilter)(it - std::begin(names));
+            else std::cerr << "unknown shadow filter " << argv[i] << "\n";
+        }
+        else if(!std::strcmp(argv[i], "-w")) {
+            i++;
+            if(!std::strcmp(argv[i], "repeat")) MSRender::Model::texture_wrap = MSRender::TextureWrap::repeat;
+            else if(std::strcmp(argv[i], "clamp")) std::cerr << "unknown texture wrap mode " << argv[i] << "\n";
+        }
+    }
+    MSRender::ThreadPool pool(thread_num);
 
     for(int i=W*H; i>=0; --i) zbuffer[i] = -z_far-1;
-    for(int i=W*H; i>=0; --i) shadow_map[i] = -std::numeric_limits<double>::max();
 
     // std::vector<std::string> model_paths = {"../obj/floor.obj"};
     // std::vector<std::string> model_paths = {"../obj/african_head/african_head.obj",
@@ -21,41 +76,167 @@ int main() {
     std::vector<std::string> model_paths = {"../obj/diablo3_pose/diablo3_pose.obj",
                                             "../obj/floor.obj"};
     // std::vector<std::string> model_paths = {"../obj/Elf01_Stand.obj"};
-    std::vector<MSRender::Light> lights = {MSRender::Light(MSRender::pointd(0,2.6,2,1), 14)};
+    std::vector<MSRender::Light> lights = {MSRender::Light(MSRender::pointr(0,2.6,2,1), 14)};
+    // 额外的光源按网格铺在地板上方
+    const TGAColor palette[] = {TGAColor(255,80,80), TGAColor(80,255,80), TGAColor(80,120,255), TGAColor(255,220,80), TGAColor(255,80,255), TGAColor(80,255,255)};
+    const int light_side = std::ceil(std::sqrt((double)extra_lights));
+    for(int i = 0; i < extra_lights; i++) {
+        MSRender::real x = -2.8 + 3.6 * (i % light_side + 0.5) / light_side, z = -2.8 + 3.6 * (i / light_side + 0.5) / light_side;
+        lights.emplace_back(MSRender::pointr(x, -0.8, z, 1), 0.02, palette[i % 6], 0.5);
+    }
+    shadow_lights = std::min(shadow_lights, lights.size());
+    std::vector<MSRender::CascadedShadowMap> shadow_maps(shadow_lights, MSRender::CascadedShadowMap(cascades, shadow_size, shadow_format));
     MSRender::VertexShader* vertex_shader = new MSRender::VertexShader();
     MSRender::PixelShader* pixel_shader = new MSRender::PhongShader(lights);
-    std::vector<MSRender::Model> models;
     std::vector<MSRender::ModelTransfParam> modelTPs(model_paths.size());
+    // 地板双面渲染
+    for(size_t m = 0; m < model_paths.size(); m++) modelTPs[m].two_sided = model_paths[m] == "../obj/floor.obj";
 
     // modelTPs[0].thetas[1] = -180.;
 
-    std::vector<MSRender::Triangle> triangles;
-    std::vector<int> model_index;
+    MSRender::RenderStats stats;
+    MSRender::VertexBuffer vertices;
+    std::vector<MSRender::TriangleRef> triangles;
+    auto geometry_start = std::chrono::steady_clock::now();
+
+    // 依次加载各模型，优先读取网格缓存，否则每个 OBJ 文件分段并行解析
+    std::vector<MSRender::Model> models(model_paths.size());
+    for(size_t m = 0; m < model_paths.size(); m++) {
+        models[m] = MSRender::Model(model_paths[m], &pool);
+        models[m].set_model_matrix(modelTPs[m]);
+    }
+    std::cout << "model loading: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - geometry_start).count() << " ms\n";
+
+    // 顶点阶段：每个去重后的顶点只变换一次（批量 SIMD 变换），按块并行。
+    // 所有模型的顶点依次放在顶点缓冲开头，三角形从缓存中按索引取顶点
+    struct Chunk { size_t model, begin, end; };
+    constexpr size_t vertex_chunk = 4096, face_chunk = 1024;
+    std::vector<std::uint32_t> bases(models.size());
+    std::vector<MSRender::VertexBatch> batches(models.size());
+    std::vector<std::vector<MSRender::Vertex>> vertex_caches(models.size());
+    std::vector<Chunk> vertex_chunks, face_chunks;
+    size_t vertex_total = 0;
+    for(size_t m = 0; m < models.size(); m++) {
+        const size_t n = models[m].vertexs_size();
+        bases[m] = vertex_total;
+        vertex_total += n;
+        batches[m].resize(n);
+        vertex_caches[m].resize(n);
+        for(size_t b = 0; b < n; b += vertex_chunk) vertex_chunks.push_back({m, b, std::min(n, b + vertex_chunk)});
+        for(size_t b = 0; b < models[m].faces_size(); b += face_chunk) face_chunks.push_back({m, b, std::min(models[m].faces_size(), b + face_chunk)});
+        stats.vertices += n;
+    }
+    vertices.resize(vertex_total);
+    pool.parallel_for(vertex_chunks.size(), [&](size_t c) {
+        const auto [m, begin, end] = vertex_chunks[c];
+        const MSRender::Model& model = models[m];
+        vertex_shader->shading(model, begin, end, batches[m]);
+        for(size_t v = begin; v < end; v++) {
+            MSRender::Vertex& vert = vertex_caches[m][v];
+            vert = batches[m].get(v);
+            vert.uv = model.get_uv(v);
+            MSRender::VertexShader::material(model, vert);
+            vertices.set(bases[m] + v, vert);
+        }
+    });
+
+    // 阴影贴图：按场景范围确定各光源各段的投影，所有光源所有段的块一起并行绘制
+    auto shadow_start = std::chrono::steady_clock::now();
+    std::vector<MSRender::pointr> shadow_corners;
+    for(size_t m = 0; m < models.size(); m++)
+        for(size_t i = 0; i < models[m].faces_size(); i++)
+            for(int j = 0; j < 3; j++) shadow_corners.push_back(vertex_caches[m][models[m].get_index(i, j)].world_pos);
+    std::vector<MSRender::CascadedShadowMap*> shadow_ptrs;
+    for(MSRender::CascadedShadowMap& shadow_map: shadow_maps) shadow_ptrs.push_back(&shadow_map);
+    pool.parallel_for(shadow_maps.size(), [&](size_t l) { shadow_maps[l].fit(lights[l], shadow_corners); });
+    MSRender::CascadedShadowMap::render_all(shadow_ptrs, shadow_corners, pool);
+    size_t shadow_bytes = 0;
+    for(const MSRender::CascadedShadowMap& shadow_map: shadow_maps) shadow_bytes += shadow_map.bytes();
+    std::cout << "shadow pass: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shadow_start).count() << " ms for "
+              << shadow_maps.size() << " lights x " << std::max(1, cascades) << " x " << shadow_size << "x" << shadow_size << " map (" << shadow_bytes / 1024 << " KiB)";
+    if(cascades && !shadow_maps.empty()) {
+        std::cout << ", cascade splits at";
+        for(int c = 0; c < shadow_maps[0].cascades(); c++) std::cout << " " << shadow_maps[0].split(c);
+    }
+    std::cout << "\n";
+
+    // 按屏幕 tile 剔除光源
+    MSRender::LightGrid light_grid;
+    light_grid.build(lights, *vertex_shader);
+    MSRender::Lighting lighting{lights, std::vector<const MSRender::CascadedShadowMap*>(lights.size(), NULL), light_culling ? &light_grid : NULL};
+    for(size_t l = 0; l < shadow_maps.size(); l++) lighting.shadows[l] = &shadow_maps[l];
+    std::cout << "light culling: " << lights.size() << " lights, " << light_grid.average() << " per tile on average\n";
 
-    int model_cnt = 0;
-    for(const std::string& path: model_paths) {
-        MSRender::Model model(path);
-        model.set_model_matrix(modelTPs[model_cnt]);
-        models.push_back(model);
-        for(size_t i = 0; i < model.faces_size(); i++) {
+    // 图元装配：按面分块并行剔除与裁剪。裁剪产生的新顶点先存在块内，
+    // 下标带 local_vertex 标记，合并时按块的顺序追加到顶点缓冲末尾，三角形顺序与串行一致
+    constexpr std::uint32_t local_vertex = 1u << 31;
+    struct Assembled {
+        std::vector<MSRender::TriangleRef> refs;
+        std::vector<MSRender::Vertex> clipped;
+    };
+    std::vector<Assembled> assembled(face_chunks.size());
+    pool.parallel_for(face_chunks.size(), [&](size_t c) {
+        const auto [m, begin, end] = face_chunks[c];
+        const MSRender::Model& model = models[m];
+        Assembled& out = assembled[c];
+        for(size_t i = begin; i < end; i++) {
             MSRender::Triangle tri;
-            for(int j = 0; j < 3; j++) {
-                tri.vertex[j] = vertex_shader->shading(model, i, j);
-                tri.vertex[j].light_space_pos = lights[0].get_light_space(tri.vertex[j].world_pos);
-                tri.vertex[j].light_space_pos.x = (tri.vertex[j].light_space_pos.x+1)*W*0.5;
-                tri.vertex[j].light_space_pos.y = (tri.vertex[j].light_space_pos.y+1)*W*0.5;
+            for(int j = 0; j < 3; j++) tri.vertex[j] = vertex_caches[m][model.get_index(i, j)];
+            if(MSRender::cull_frustum(tri, &stats)) continue;
+            if(!MSRender::clip_planes(tri)) {
+                if(!modelTPs[m].two_sided && MSRender::cull_backface(tri, &stats)) continue;
+                out.refs.push_back({{bases[m] + model.get_index(i, 0), bases[m] + model.get_index(i, 1), bases[m] + model.get_index(i, 2)}, (std::uint32_t)m});
+                continue;
             }
-            triangles.push_back(tri);
-            model_index.push_back(model_cnt);
-            MSRender::shadow(tri, shadow_map);
+            MSRender::Triangle clipped[MSRender::max_clipped_triangles];
+            int clipped_cnt = MSRender::clip_triangle(tri, clipped);
+            for(int k = 0; k < clipped_cnt; k++) {
+                if(!modelTPs[m].two_sided && MSRender::cull_backface(clipped[k], &stats)) continue;
+                MSRender::TriangleRef ref;
+                for(int j = 0; j < 3; j++) {
+                    ref.v[j] = local_vertex | (std::uint32_t)out.clipped.size();
+                    out.clipped.push_back(clipped[k].vertex[j]);
+                }
+                ref.model = m;
+                out.refs.push_back(ref);
+            }
+        }
+    });
+    for(Assembled& out: assembled) {
+        std::uint32_t base = vertices.size();
+        vertices.resize(base + out.clipped.size());
+        for(size_t k = 0; k < out.clipped.size(); k++) vertices.set(base + k, out.clipped[k]);
+        for(MSRender::TriangleRef ref: out.refs) {
+            for(int j = 0; j < 3; j++)
+                if(ref.v[j] & local_vertex) ref.v[j] = base + (ref.v[j] & ~local_vertex);
+            triangles.push_back(ref);
         }
-        model_cnt++;
     }
-    for(size_t i = 0; i < triangles.size(); i++) {
-        MSRender::rasterize(triangles[i], image, models[model_index[i]], pixel_shader, zbuffer, lights[0], shadow_map);
+    std::cout << "geometry stage: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - geometry_start).count()
+              << " ms on " << pool.size() << " threads\n";
+    MSRender::GBuffer gbuffer;
+    if(mode == MSRender::RenderMode::deferred) gbuffer.resize(W*H);
+    MSRender::FrameContext frame{image, zbuffer, &hiz, &gbuffer, &stats};
+    // 对比逐三角形保存完整 Vertex 的存储方式
+    size_t fat_bytes = triangles.size() * (sizeof(MSRender::Triangle) + sizeof(int));
+    size_t compact_bytes = triangles.size() * sizeof(MSRender::TriangleRef) + vertices.bytes();
+    std::cout << "triangle storage: " << fat_bytes << " bytes (" << fat_bytes / std::max<size_t>(1, triangles.size()) << " per triangle) as Triangle copies, "
+              << compact_bytes << " bytes (" << compact_bytes / std::max<size_t>(1, triangles.size()) << " per triangle) indexed\n";
+    auto raster_start = std::chrono::steady_clock::now();
+    MSRender::rasterize_tiled(vertices, triangles, models, pixel_shader, lighting, frame, pool, mode);
+    std::cout << "rasterization: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - raster_start).count() << " ms\n";
+    std::cout << "vertices shaded: " << stats.vertices << " (" << stats.triangles * 3 << " triangle corners)\n"
+              << "triangles: " << stats.triangles
+              << ", culled back-facing: " << stats.culled_backface
+              << ", culled outside frustum: " << stats.culled_frustum << "\n"
+              << "fragments passing depth test: " << stats.fragments << "\n"
+              << "shading invocations: " << stats.shading << "\n";
+    // 第一个光源的阴影贴图
+    if(!shadow_maps.empty()) {
+        TGAImage z_image(shadow_size * shadow_maps[0].cascades(), shadow_size, TGAImage::RGB);
+        shadow_maps[0].draw(z_image, TGAColor(255,255,255));
+        z_image.write_tga_file("z_out.tga");
     }
-    MSRender::draw_zbuffer(shadow_map, z_image, TGAColor(255,255,255));
-    z_image.write_tga_file("z_out.tga");
     image.write_tga_file("output.tga");
     delete vertex_shader;
     delete pixel_shader;
@@ -0,0 +1,203 @@
+// 二进制网格缓存（.msrmesh），与 OBJ 文件放在同一目录。
+// 文件由定长的头和若干按 64 字节对齐的段组成：
+//   头：魔数、版本、real 的字节数、法线贴图类型、源文件（OBJ 与四张贴图）的大小和修改时间、
+//       去重后的顶点数与下标数、四张贴图的尺寸，以及每个段的偏移和长度
+//   段：位置 x/y/z、法线 x/y/z、uv、下标，以及已经翻转好的四张贴图像素
+// 任一源文件的大小或修改时间变化、版本或精度不一致时缓存失效，下次加载时重新生成。
+// 读取时映射整个文件，校验后把各段直接拷贝进 Model 的数组，不再做任何解析
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include "model.h"
+#include "fileview.h"
+
+using namespace MSRender;
+
+namespace {
+    constexpr char cache_magic[8] = {'M', 'S', 'R', 'M', 'E', 'S', 'H', '\0'};
+    constexpr std::uint32_t cache_version = 1;
+    constexpr size_t section_align = 64;
+    constexpr int texture_num = 4;
+    constexpr int source_num = texture_num + 1;
+
+    enum Section { sec_px, sec_py, sec_pz, sec_nx, sec_ny, sec_nz, sec_uv, sec_index, sec_texture0, section_num = sec_texture0 + texture_num };
+
+    struct SourceStamp {
+        std::int64_t size;   // 文件不存在时为 -1
+        std::int64_t mtime;
+    };
+    struct TextureDesc {
+        std::int32_t width, height, bytespp, present;
+    };
+    struct SectionDesc {
+        std::uint64_t offset, bytes;
+    };
+    struct CacheHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t real_bytes;
+        std::uint32_t nm_in_tangent;
+        std::uint32_t reserved;
+        SourceStamp sources[source_num];
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+        TextureDesc textures[texture_num];
+        SectionDesc sections[section_num];
+    };
+
+    std::string cache_path(const std::string& filename) {
+        size_t dot = filename.find_last_of(".");
+        return (dot == std::string::npos ? filename : filename.substr(0, dot)) + ".msrmesh";
+    }
+
+    // 与 Model::load_texture 使用相同的贴图路径
+    std::string texture_path(const std::string& filename, int i) {
+        const char* suffixes[texture_num] = {"_diffuse.tga", Model::nm_is_in_tangent ? "_nm_tangent.tga" : "_nm.tga", "_spec.tga", "_glow.tga"};
+        size_t dot = filename.find_last_of(".");
+        if(dot == std::string::npos) return std::string();
+        return filename.substr(0, dot) + suffixes[i];
+    }
+
+    SourceStamp stamp(const std::string& path) {
+        std::error_code ec;
+        SourceStamp s = {-1, 0};
+        if(path.empty()) return s;
+        auto size = std::filesystem::file_size(path, ec);
+        if(ec) return s;
+        auto time = std::filesystem::last_write_time(path, ec);
+        if(ec) return s;
+        s.size = (std::int64_t)size;
+        s.mtime = (std::int64_t)time.time_since_epoch().count();
+        return s;
+    }
+
+    void source_stamps(const std::string& filename, SourceStamp* out) {
+        out[0] = stamp(filename);
+        for(int i = 0; i < texture_num; i++) out[i + 1] = stamp(texture_path(filename, i));
+    }
+
+    size_t align_up(size_t n) { return (n + section_align - 1) & ~(section_align - 1); }
+}
+
+bool Model::read_cache(const std::string& filename) {
+    const std::string path = cache_path(filename);
+    FileView file;
+    if(!file.open(path) || file.size() < sizeof(CacheHeader)) return false;
+    CacheHeader header;
+    std::memcpy(&header, file.begin(), sizeof(header));
+    if(std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) || header.version != cache_version
+       || header.real_bytes != sizeof(real) || header.nm_in_tangent != (std::uint32_t)nm_is_in_tangent)
+        return false;
+    SourceStamp sources[source_num];
+    source_stamps(filename, sources);
+    if(sources[0].size < 0) return false;
+    for(int i = 0; i < source_num; i++)
+        if(sources[i].size != header.sources[i].size || sources[i].mtime != header.sources[i].mtime) return false;
+
+    // 各段的长度必须与头中的计数一致，且不超出文件
+    const size_t n = header.vertex_count;
+    size_t expected[section_num] = {n * sizeof(real), n * sizeof(real), n * sizeof(real),
+                                    n * sizeof(real), n * sizeof(real), n * sizeof(real),
+                                    n * sizeof(uvr), header.index_count * sizeof(int)};
+    for(int t = 0; t < texture_num; t++) {
+        const TextureDesc& d = header.textures[t];
+        // 尺寸为负时乘积也可能恰好等于段长，必须先检查每一项
+        if(d.present && (d.width <= 0 || d.height <= 0
+           || (d.bytespp != TGAImage::GRAYSCALE && d.bytespp != TGAImage::RGB && d.bytespp != TGAImage::RGBA)))
+            return false;
+        expected[sec_texture0 + t] = d.present ? (size_t)d.width * d.height * d.bytespp : 0;
+    }
+    for(int s = 0; s < section_num; s++) {
+        const SectionDesc& d = header.sections[s];
+        if(d.bytes != expected[s] || d.offset % section_align || d.offset > file.size() || d.bytes > file.size() - d.offset) return false;
+    }
+    auto section = [&](int s) { return file.begin() + header.sections[s].offset; };
+
+    Vec3Stream* streams[2] = {&positions, &normals};
+    for(int k = 0; k < 2; k++) {
+        streams[k]->resize(n);
+        std::memcpy(streams[k]->x.data(), section(sec_px + 3 * k), n * sizeof(real));
+        std::memcpy(streams[k]->y.data(), section(sec_py + 3 * k), n * sizeof(real));
+        std::memcpy(streams[k]->z.data(), section(sec_pz + 3 * k), n * sizeof(real));
+    }
+    uvs.resize(n);
+    std::memcpy((void*)uvs.data(), section(sec_uv), n * sizeof(uvr));
+    indices.resize(header.index_count);
+    std::memcpy(indices.data(), section(sec_index), indices.size() * sizeof(int));
+    for(int i: indices) {
+        if(i < 0 || (size_t)i >= n) {
+            positions.resize(0), normals.resize(0), uvs.clear(), indices.clear();
+            return false;
+        }
+    }
+
+    TGAImage* images[texture_num] = {&diffusemap_, &normalmap_, &specularmap_, &glowmap_};
+    bool* present[texture_num] = {&has_diffusemap, &has_normalmap, &has_specularmap, &has_glowmap};
+    for(int t = 0; t < texture_num; t++) {
+        const TextureDesc& d = header.textures[t];
+        *present[t] = d.present;
+        *images[t] = d.present ? TGAImage(d.width, d.height, d.bytespp) : TGAImage();
+        if(d.present) std::memcpy(images[t]->buffer(), section(sec_texture0 + t), header.sections[sec_texture0 + t].bytes);
+    }
+    std::cerr << "mesh cache " << path << " loading ok\n";
+    return true;
+}
+
+bool Model::write_cache(const std::string& filename) const {
+    const std::string path = cache_path(filename);
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.real_bytes = sizeof(real);
+    header.nm_in_tangent = nm_is_in_tangent;
+    source_stamps(filename, header.sources);
+    header.vertex_count = positions.size();
+    header.index_count = indices.size();
+
+    const TGAImage* images[texture_num] = {&diffusemap_, &normalmap_, &specularmap_, &glowmap_};
+    const bool present[texture_num] = {has_diffusemap, has_normalmap, has_specularmap, has_glowmap};
+    const size_t n = positions.size();
+    const void* data[section_num] = {positions.x.data(), positions.y.data(), positions.z.data(),
+                                     normals.x.data(), normals.y.data(), normals.z.data(),
+                                     uvs.data(), indices.data()};
+    size_t bytes[section_num] = {n * sizeof(real), n * sizeof(real), n * sizeof(real),
+                                 n * sizeof(real), n * sizeof(real), n * sizeof(real),
+                                 n * sizeof(uvr), indices.size() * sizeof(int)};
+    for(int t = 0; t < texture_num; t++) {
+        TGAImage& img = const_cast<TGAImage&>(*images[t]);
+        header.textures[t] = {img.get_width(), img.get_height(), img.get_bytespp(), present[t]};
+        data[sec_texture0 + t] = present[t] ? img.buffer() : nullptr;
+        bytes[sec_texture0 + t] = present[t] ? (size_t)img.get_width() * img.get_height() * img.get_bytespp() : 0;
+    }
+    size_t offset = align_up(sizeof(CacheHeader));
+    for(int s = 0; s < section_num; s++) {
+        header.sections[s] = {offset, bytes[s]};
+        offset = align_up(offset + bytes[s]);
+    }
+
+    // 先写临时文件再改名，中途失败不会留下损坏的缓存；临时文件名带随机后缀，多个进程同时写同一缓存时互不覆盖
+    const std::string tmp = path + ".tmp" + std::to_string(std::random_device{}());
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if(!out) return false;
+    static const char zeros[section_align] = {};
+    out.write((const char*)&header, sizeof(header));
+    size_t written = sizeof(header);
+    for(int s = 0; s < section_num; s++) {
+        out.write(zeros, header.sections[s].offset - written);
+        if(bytes[s]) out.write((const char*)data[s], bytes[s]);
+        written = header.sections[s].offset + bytes[s];
+    }
+    out.close();
+    std::error_code ec;
+    if(!out || (std::filesystem::rename(tmp, path, ec), ec)) {
+        std::filesystem::remove(tmp, ec);
+        std::cerr << "cannot write mesh cache " << path << "\n";
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
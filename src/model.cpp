@@ -1,77 +1,117 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <unordered_map>
 #include "model.h"
+#include "objloader.h"
+#include "threadpool.h"
 #include "global.h"
 
 using namespace MSRender;
 
 bool Model::nm_is_in_tangent = true;
+bool Model::use_mesh_cache = true;
+TextureFilter Model::texture_filter = TextureFilter::trilinear;
+TextureWrap Model::texture_wrap = TextureWrap::clamp;
 
-Model::Model(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if(in.fail()) {
-        std::cerr << "cannot load the model\n";
-        return ;
+Model::Model(const std::string filename, ThreadPool* pool) {
+    const bool cached = use_mesh_cache && read_cache(filename);
+    if(!cached && !load_source(filename, pool)) return;
+    if(!cached && use_mesh_cache) write_cache(filename);
+    // 缓存中只保存第 0 层，两种加载方式都在这里生成 mip 链
+    build_mipmaps(pool);
+}
+
+bool Model::load_source(const std::string& filename, ThreadPool* pool) {
+    ObjData obj;
+    std::string error;
+    if(!load_obj(filename, obj, error, pool)) {
+        std::cerr << "cannot load the model: " << error << "\n";
+        return false;
     }
-    std::string line;
-    std::string _; // 过滤字符串
-    while(!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line);
-        if(!line.compare(0, 2, "v ")) {
-            pointd v;
-            iss >> _ >> v.x >> v.y >> v.z;
-            v.w = 1;
-            vertices.push_back(v);
-        }
-        else if(!line.compare(0, 3, "vt ")) {
-            uvd vt;
-            iss >> _ >> vt.u >> vt.v;
-            uvs.push_back(vt);
-        }
-        else if(!line.compare(0, 3, "vn ")) {
-            vecd vn;
-            iss >> _ >> vn.x >> vn.y >> vn.z;
-            vn.w = 0;
-            normals.push_back(vn);
+    const std::vector<int>& face_vertices = obj.corner_v;
+    const std::vector<int>& face_uvs = obj.corner_vt;
+    const std::vector<int>& face_normal = obj.corner_vn;
+    const std::vector<pointr>& raw_vertices = obj.positions;
+    const std::vector<uvr>& raw_uvs = obj.uvs;
+
+    // 没有给出法线的角使用相邻面按面积加权的平均法线
+    std::vector<vecr> smooth_normals;
+    for(size_t i = 0; i < face_normal.size(); i += 3) {
+        if(face_normal[i] >= 0 && face_normal[i+1] >= 0 && face_normal[i+2] >= 0) continue;
+        if(smooth_normals.empty()) smooth_normals.assign(raw_vertices.size(), vecr(0, 0, 0, 0));
+        const pointr& a = raw_vertices[face_vertices[i]];
+        vecr n = cross(raw_vertices[face_vertices[i+1]] - a, raw_vertices[face_vertices[i+2]] - a);
+        for(int j = 0; j < 3; j++) smooth_normals[face_vertices[i+j]] += n;
+    }
+    for(vecr& n: smooth_normals) if(n.norm2() > 0) n.normalize();
+
+    // 合并相同的 (v, vt, vn) 组合，建立统一的索引
+    struct key_hash {
+        size_t operator()(const std::tuple<int, int, int>& k) const {
+            size_t h = std::hash<int>()(std::get<0>(k));
+            h = h * 1000003u ^ std::hash<int>()(std::get<1>(k));
+            return h * 1000003u ^ std::hash<int>()(std::get<2>(k));
         }
-        else if(!line.compare(0, 2, "f ")) {
-            int v, t, n, cnt = 0;
-            char c;
-            iss >> c;
-            while(iss >> v >> c >> t >> c >> n) {
-                face_vertices.push_back(v-1);
-                face_uvs.push_back(t-1);
-                face_normal.push_back(n-1);
-                cnt++;
-            }
-            if (cnt != 3) {
-                std::cerr << "Error: the obj file is supposed to be triangulated\n";
-                in.close();
-                return;
-            }
+    };
+    std::unordered_map<std::tuple<int, int, int>, int, key_hash> unique;
+    unique.reserve(face_vertices.size());
+    indices.reserve(face_vertices.size());
+    positions.reserve(raw_vertices.size());
+    normals.reserve(raw_vertices.size());
+    for(size_t i = 0; i < face_vertices.size(); i++) {
+        auto [it, inserted] = unique.try_emplace(std::make_tuple(face_vertices[i], face_uvs[i], face_normal[i]), (int)positions.size());
+        if(inserted) {
+            const pointr& p = raw_vertices[face_vertices[i]];
+            const vecr& n = face_normal[i] >= 0 ? obj.normals[face_normal[i]] : smooth_normals[face_vertices[i]];
+            positions.push(p.x, p.y, p.z);
+            uvs.push_back(face_uvs[i] >= 0 ? raw_uvs[face_uvs[i]] : uvr(0, 0));
+            normals.push(n.x, n.y, n.z);
         }
+        indices.push_back(it->second);
     }
-    in.close();
     has_diffusemap = load_texture(filename, "_diffuse.tga", diffusemap_);
     has_normalmap = load_texture(filename, (Model::nm_is_in_tangent? "_nm_tangent.tga":"_nm.tga"), normalmap_);
     has_specularmap = load_texture(filename, "_spec.tga", specularmap_);
     has_glowmap = load_texture(filename, "_glow.tga", glowmap_);
+    return true;
+}
+
+void Model::build_mipmaps(ThreadPool* pool) {
+    TGAImage* images[4] = {&diffusemap_, &normalmap_, &specularmap_, &glowmap_};
+    Texture* mips[4] = {&diffuse_mips_, &normal_mips_, &specular_mips_, &glow_mips_};
+    const bool present[4] = {has_diffusemap, has_normalmap, has_specularmap, has_glowmap};
+    auto build = [&](size_t i) { if(present[i]) *mips[i] = Texture(*images[i]); };
+    if(pool) pool->parallel_for(4, build);
+    else for(size_t i = 0; i < 4; i++) build(i);
 }
 
 size_t Model::vertexs_size() const {
-    return vertices.size();
+    return positions.size();
 }
 
 size_t Model::faces_size() const {
-    return face_vertices.size() / 3;
+    return indices.size() / 3;
+}
+
+int Model::get_index(const size_t iface, const size_t nthvert) const {
+    return indices[iface*3+nthvert];
+}
+
+pointr Model::get_vertex(const size_t iface, const size_t nthvert) const {
+    if(iface*3+nthvert >= indices.size()) return pointr(0., 0., 0., 1.);
+    return get_vertex(indices[iface*3+nthvert]);
+}
+
+pointr Model::get_vertex(const size_t index) const {
+    return pointr(positions.x[index], positions.y[index], positions.z[index], 1);
 }
 
-pointd Model::get_vertex(const size_t iface, const size_t nthvert) const {
-    if(iface*3+nthvert >= face_normal.size()) return pointd(0., 0., 0., 1.);
-    return vertices[face_vertices[iface*3+nthvert]];
+uvr Model::get_uv(const size_t index) const {
+    return uvs[index];
+}
+
+vecr Model::get_normal(const size_t index) const {
+    return vecr(normals.x[index], normals.y[index], normals.z[index], 0);
 }
 
 bool Model::load_texture(std::string filename, const std::string suffix, TGAImage &img) {
@@ -84,52 +124,94 @@ bool Model::load_texture(std::string filename, const std::string suffix, TGAImag
     return flag;
 }
 
-vecd Model::get_normal_with_map(const uvd &uv) const {
-    TGAColor c = normalmap_.get(uv.u*normalmap_.get_width(), uv.v*normalmap_.get_height());
-    vecd res;
+// 不带差分的采样都是第 0 层最近邻，从打包的纹素中取通道
+vecr Model::get_normal_with_map(const uvr &uv) const {
+    return get_normal_with_map(uv.u, uv.v);
+}
+vecr Model::get_diffuse(const uvr &uv) const {
+    return get_diffuse(uv.u, uv.v);
+}
+real Model::get_specular(const uvr &uv) const {
+    return get_specular(uv.u, uv.v);
+}
+vecr Model::get_glow(const uvr &uv) const {
+    return get_glow(uv.u, uv.v);
+}
+
+vecr Model::get_normal_with_map(const real uv0, const real uv1) const {
+    vecr c = normal_mips_.fetch(uv0, uv1);
+    vecr res;
     for (int i=0; i<3; i++)
         res[2-i] = (c[i] * 2. / 255.) - 1;
     return res;
 }
-vecd Model::get_diffuse(const uvd &uv) const {
-    TGAColor c = diffusemap_.get(uv.u*diffusemap_.get_width(), uv.v*diffusemap_.get_height());
-    return vecd(c[2], c[1], c[0]);
+vecr Model::get_glow(const real uv0, const real uv1) const {
+    vecr c = glow_mips_.fetch(uv0, uv1);
+    return vecr(c[2], c[1], c[0]);
 }
-double Model::get_specular(const uvd &uv) const {
-    return specularmap_.get(uv.u*specularmap_.get_width(), uv.v*specularmap_.get_height())[0];
+vecr Model::get_diffuse(const real uv0, const real uv1) const {
+    vecr c = diffuse_mips_.fetch(uv0, uv1);
+    return vecr(c[2], c[1], c[0]);
 }
-vecd Model::get_glow(const uvd &uv) const {
-    TGAColor c = glowmap_.get(uv.u*glowmap_.get_width(), uv.v*glowmap_.get_height());
-    return vecd(c[2], c[1], c[0]);
+real Model::get_specular(const real uv0, const real uv1) const {
+    return specular_mips_.fetch_packed(uv0, uv1) & 255;
 }
 
-vecd Model::get_normal_with_map(const double uv0, const double uv1) const {
-    TGAColor c = normalmap_.get(uv0*normalmap_.get_width(), uv1*normalmap_.get_height());
-    vecd res;
+// nearest 时与不带差分的版本完全相同
+vecr Model::get_diffuse(const uvr& uv, const uvr& dx, const uvr& dy) const {
+    if(texture_filter == TextureFilter::nearest) return get_diffuse(uv);
+    vecr c = diffuse_mips_.sample(uv, dx, dy, texture_filter, texture_wrap);
+    return vecr(c[2], c[1], c[0]);
+}
+vecr Model::get_glow(const uvr& uv, const uvr& dx, const uvr& dy) const {
+    if(texture_filter == TextureFilter::nearest) return get_glow(uv);
+    vecr c = glow_mips_.sample(uv, dx, dy, texture_filter, texture_wrap);
+    return vecr(c[2], c[1], c[0]);
+}
+real Model::get_specular(const uvr& uv, const uvr& dx, const uvr& dy) const {
+    if(texture_filter == TextureFilter::nearest) return get_specular(uv);
+    return specular_mips_.sample(uv, dx, dy, texture_filter, texture_wrap)[0];
+}
+vecr Model::get_normal_with_map(const uvr& uv, const uvr& dx, const uvr& dy) const {
+    if(texture_filter == TextureFilter::nearest) return get_normal_with_map(uv);
+    vecr c = normal_mips_.sample(uv, dx, dy, texture_filter, texture_wrap);
+    vecr res;
     for (int i=0; i<3; i++)
         res[2-i] = (c[i] * 2. / 255.) - 1;
     return res;
 }
-vecd Model::get_glow(const double uv0, const double uv1) const {
-    TGAColor c = glowmap_.get(uv0*glowmap_.get_width(), uv1*glowmap_.get_height());
-    return vecd(c[2], c[1], c[0]);
-}
-vecd Model::get_diffuse(const double uv0, const double uv1) const {
-    TGAColor c = diffusemap_.get(uv0*diffusemap_.get_width(), uv1*diffusemap_.get_height());
-    return vecd(c[2], c[1], c[0]);
-}
-double Model::get_specular(const double uv0, const double uv1) const {
-    return specularmap_.get(uv0*specularmap_.get_width(), uv1*specularmap_.get_height())[0];
+
+void Model::sample_materials(const uvr* uv, const uvr* dx, const uvr* dy, int n, MaterialSamples& out) const {
+    alignas(32) float u[Texture::batch], v[Texture::batch], lod[Texture::batch];
+    alignas(32) float c[4][Texture::batch];
+    for(int i = 0; i < n; i++) u[i] = uv[i].u, v[i] = uv[i].v;
+    const Texture* maps[4] = {&diffuse_mips_, &normal_mips_, &specular_mips_, &glow_mips_};
+    const bool present[4] = {has_diffusemap, has_normalmap, has_specularmap, has_glowmap};
+    for(int m = 0; m < 4; m++) {
+        if(!present[m]) continue;
+        // 各贴图尺寸不同，LOD 分别计算
+        for(int i = 0; i < n; i++) lod[i] = maps[m]->lod(dx[i], dy[i]);
+        maps[m]->sample(u, v, lod, n, texture_filter, texture_wrap, c);
+        for(int i = 0; i < n; i++) {
+            if(m == 0) out.diffuse[i] = vecr(c[2][i], c[1][i], c[0][i]);
+            else if(m == 1) {
+                for(int k = 0; k < 3; k++) out.normal[i][2-k] = (c[k][i] * 2. / 255.) - 1;
+                out.normal[i].w = 0;
+            }
+            else if(m == 2) out.specular[i] = c[0][i];
+            else out.glow[i] = vecr(c[2][i], c[1][i], c[0][i]);
+        }
+    }
 }
 
-uvd Model::get_uv(const size_t iface, const size_t nthvert) const {
-    if(iface*3+nthvert >= face_normal.size()) return uvd(0., 0.);
-    return uvs[face_uvs[iface*3+nthvert]];
+uvr Model::get_uv(const size_t iface, const size_t nthvert) const {
+    if(iface*3+nthvert >= indices.size()) return uvr(0., 0.);
+    return uvs[indices[iface*3+nthvert]];
 }
 
-vecd Model::get_normal(const size_t iface, const size_t nthvert) const {
-    if(iface*3+nthvert >= face_normal.size()) return vecd(0., 0., 0.);
-    return normals[face_normal[iface*3+nthvert]];
+vecr Model::get_normal(const size_t iface, const size_t nthvert) const {
+    if(iface*3+nthvert >= indices.size()) return vecr(0., 0., 0.);
+    return get_normal(indices[iface*3+nthvert]);
 }
 
 const TGAImage& Model::get_diffusemap() const {
@@ -146,37 +228,37 @@ const TGAImage& Model::get_glowmap() const {
 }
 
 void Model::set_model_matrix(const ModelTransfParam& param) {
-    mat4d Scale;
+    mat4r Scale;
     Scale[0][0] = param.scale[0];
     Scale[1][1] = param.scale[1];
     Scale[2][2] = param.scale[2];
     Scale[3][3] = 1;
-    double cosx = std::cos(param.thetas[0]*PI/180.);
-    double sinx = std::sin(param.thetas[0]*PI/180.);
-    double cosy = std::cos(param.thetas[1]*PI/180.);
-    double siny = std::sin(param.thetas[1]*PI/180.);
-    double cosz = std::cos(param.thetas[2]*PI/180.);
-    double sinz = std::sin(param.thetas[2]*PI/180.);
-    mat4d Rotate;
-    Rotate[0] = vecd(cosy*cosz, -cosy*sinz, siny, 0);
-    Rotate[1] = vecd(sinx*siny*cosz+cosx*sinz, -sinx*siny*sinz+cosx*cosz, -sinx*cosy, 0);
-    Rotate[2] = vecd(-cosx*siny*cosz+sinx*sinz, cosx*siny*sinz+sinx*cosz, cosx*cosy, 0);
+    real cosx = std::cos(param.thetas[0]*PI/180.);
+    real sinx = std::sin(param.thetas[0]*PI/180.);
+    real cosy = std::cos(param.thetas[1]*PI/180.);
+    real siny = std::sin(param.thetas[1]*PI/180.);
+    real cosz = std::cos(param.thetas[2]*PI/180.);
+    real sinz = std::sin(param.thetas[2]*PI/180.);
+    mat4r Rotate;
+    Rotate[0] = vecr(cosy*cosz, -cosy*sinz, siny, 0);
+    Rotate[1] = vecr(sinx*siny*cosz+cosx*sinz, -sinx*siny*sinz+cosx*cosz, -sinx*cosy, 0);
+    Rotate[2] = vecr(-cosx*siny*cosz+sinx*sinz, cosx*siny*sinz+sinx*cosz, cosx*cosy, 0);
     Rotate[3][3] = 1;
-    // mat4d RotateX;
+    // mat4r RotateX;
     // RotateX[0][0] = 1, RotateX[3][3] = 1;
     // RotateX[1][1] = cosx, RotateX[1][2] = -sinx;
     // RotateX[2][1] = sinx, RotateX[2][2] = cosx;
-    // mat4d RotateY;
+    // mat4r RotateY;
     // RotateY[1][1] = 1, RotateY[3][3] = 1;
     // RotateY[0][0] = cosy, RotateY[0][2] = siny;
     // RotateY[2][0] = -siny, RotateY[2][2] = cosy;
-    // mat4d RotateZ;
+    // mat4r RotateZ;
     // RotateZ[2][2] = 1, RotateZ[3][3] = 1;
     // RotateZ[0][0] = cosz, RotateZ[0][1] = -sinz;
     // RotateZ[1][0] = sinz, RotateZ[1][1] = cosz;
     // Rotate = RotateX * RotateY * RotateZ;
     // std::cout<<Rotate;
-    mat4d Translate(true);
+    mat4r Translate(true);
     Translate[0][3] = param.translate[0];
     Translate[1][3] = param.translate[1];
     Translate[2][3] = param.translate[2];
@@ -189,10 +271,10 @@ void Model::set_normal_matrix() {
     normal_matrix = model_matrix.inverse().Transpose();
 }
 
-pointd Model::model_transf(pointd&& p) const {
+pointr Model::model_transf(pointr&& p) const {
     return model_matrix * p;
 }
 
-vecd Model::model_nm_transf(vecd&& nm) const {
+vecr Model::model_nm_transf(vecr&& nm) const {
     return (normal_matrix * nm).normalized();
 }
\ No newline at end of file
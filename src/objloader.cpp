@@ -0,0 +1,328 @@
+#include "objloader.h"
+#include "threadpool.h"
+#include "fileview.h"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+using namespace MSRender;
+
+void ObjData::clear() {
+    positions.clear(), uvs.clear(), normals.clear();
+    corner_v.clear(), corner_vt.clear(), corner_vn.clear();
+    face_size.clear();
+}
+
+static inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static inline const char* skip_space(const char* p, const char* end) {
+    while(p < end && is_space(*p)) p++;
+    return p;
+}
+
+// 浮点数交给 from_chars，结果与 strtod / istream 一样是正确舍入的
+static inline bool parse_real(const char*& p, const char* end, real& value) {
+    p = skip_space(p, end);
+    if(p < end && *p == '+') p++;
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    if(ec != std::errc()) return false;
+    p = ptr;
+    return true;
+}
+
+static inline bool parse_int(const char*& p, const char* end, int& value) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if(p >= end || *p < '0' || *p > '9') return false;
+    long long v = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if(v > 0x7fffffff) return false;
+    }
+    value = negative ? -(int)v : (int)v;
+    return true;
+}
+
+
+// 一段文本的解析结果。OBJ 下标从 1 开始，负数表示相对当前已定义个数的倒数第几个。
+// 段内不知道之前各段定义了多少属性，所以正数下标直接换算成绝对下标，负数下标先记为相对本段开头的下标，
+// 拼接时再加上之前各段的个数；越界检查也推迟到拼接时，只记录最坏的情况
+struct ObjChunk {
+    ObjData data;
+    std::vector<size_t> relative[3];              // 使用负数下标的角，依次对应 v、vt、vn
+    long long max_ahead[3] = {LLONG_MIN, LLONG_MIN, LLONG_MIN}; // max(绝对下标 - 段内此前的个数)，须小于之前各段的个数
+    long long min_relative[3] = {0, 0, 0};        // min(相对下标)，不能小于 -之前各段的个数
+    size_t ahead_line[3] = {0, 0, 0}, relative_line[3] = {0, 0, 0};
+    size_t triangle_corners = 0;                  // 三角化后的角数
+    bool polygons = false;                        // 是否含有多于三个角的面
+    size_t lines = 0;
+    size_t error_line = 0;
+    std::string error;
+};
+
+static const char* const index_errors[3] = {"bad vertex index", "bad texture index", "bad normal index"};
+
+static void parse_chunk(const char* begin, const char* end, ObjChunk& chunk) {
+    ObjData& out = chunk.data;
+    size_t line_no = 0;
+    auto fail = [&](const char* what) {
+        chunk.error_line = line_no;
+        chunk.error = what;
+    };
+    // 解析一个下标，attr 为 0、1、2 时分别对应 v、vt、vn
+    auto parse_index = [&](const char*& p, const char* eol, int attr, size_t count, std::vector<int>& corners) {
+        int raw;
+        if(!parse_int(p, eol, raw) || raw == 0) return false;
+        if(raw > 0) {
+            long long ahead = (long long)raw - 1 - (long long)count;
+            if(ahead > chunk.max_ahead[attr]) chunk.max_ahead[attr] = ahead, chunk.ahead_line[attr] = line_no;
+            corners.push_back(raw - 1);
+        }
+        else {
+            long long local = (long long)count + raw;
+            if(local < chunk.min_relative[attr]) chunk.min_relative[attr] = local, chunk.relative_line[attr] = line_no;
+            chunk.relative[attr].push_back(corners.size());
+            corners.push_back((int)local);
+        }
+        return true;
+    };
+    for(const char* line = begin; line < end; ) {
+        const char* eol = (const char*)std::memchr(line, '\n', end - line);
+        if(!eol) eol = end;
+        line_no++;
+        const char* p = skip_space(line, eol);
+        line = eol + 1;
+        if(p == eol || *p == '#') continue;
+
+        const char* key = p;
+        while(p < eol && !is_space(*p)) p++;
+        const size_t key_len = p - key;
+        if(key_len == 1 && key[0] == 'v') {
+            pointr v(0, 0, 0, 1);
+            if(!parse_real(p, eol, v.x) || !parse_real(p, eol, v.y) || !parse_real(p, eol, v.z)) return fail("bad vertex");
+            out.positions.push_back(v);
+        }
+        else if(key_len == 2 && key[0] == 'v' && key[1] == 't') {
+            uvr vt(0, 0);
+            if(!parse_real(p, eol, vt.u)) return fail("bad texture coordinate");
+            parse_real(p, eol, vt.v);
+            out.uvs.push_back(vt);
+        }
+        else if(key_len == 2 && key[0] == 'v' && key[1] == 'n') {
+            vecr vn(0, 0, 0, 0);
+            if(!parse_real(p, eol, vn.x) || !parse_real(p, eol, vn.y) || !parse_real(p, eol, vn.z)) return fail("bad normal");
+            out.normals.push_back(vn);
+        }
+        else if(key_len == 1 && key[0] == 'f') {
+            int corners = 0;
+            for(p = skip_space(p, eol); p < eol; p = skip_space(p, eol)) {
+                if(!parse_index(p, eol, 0, out.positions.size(), out.corner_v)) return fail(index_errors[0]);
+                bool has_vt = false, has_vn = false;
+                if(p < eol && *p == '/') {
+                    p++;
+                    if(p < eol && *p != '/') {
+                        if(!parse_index(p, eol, 1, out.uvs.size(), out.corner_vt)) return fail(index_errors[1]);
+                        has_vt = true;
+                    }
+                    if(p < eol && *p == '/') {
+                        p++;
+                        if(!parse_index(p, eol, 2, out.normals.size(), out.corner_vn)) return fail(index_errors[2]);
+                        has_vn = true;
+                    }
+                }
+                if(p < eol && !is_space(*p)) return fail("bad face corner");
+                if(!has_vt) out.corner_vt.push_back(-1);
+                if(!has_vn) out.corner_vn.push_back(-1);
+                corners++;
+            }
+            if(corners < 3) return fail("face with less than 3 vertices");
+            out.face_size.push_back(corners);
+            chunk.triangle_corners += 3 * (corners - 2);
+            chunk.polygons |= corners > 3;
+        }
+    }
+    chunk.lines = line_no;
+}
+
+// 三角化用到的临时数组，每个线程一份
+struct PolygonScratch {
+    std::vector<double> u, v;
+    std::vector<int> remaining;
+};
+
+static inline double orient(const PolygonScratch& s, int a, int b, int c) {
+    return (s.u[b] - s.u[a]) * (s.v[c] - s.v[a]) - (s.v[b] - s.v[a]) * (s.u[c] - s.u[a]);
+}
+
+// 把 n 个角的多边形切成 n-2 个三角形，依次写入面内的角序号，保持原来的环绕方向。
+// 先用 Newell 法线选出投影平面，凸多边形按扇形切分，凹多边形用耳切法；
+// 自相交或退化的多边形找不到耳朵时直接切掉当前的角，保证总能输出 n-2 个三角形
+static void triangulate(const std::vector<pointr>& positions, const int* v, int n, std::vector<int>& out, PolygonScratch& s) {
+    if(n == 3) {
+        out.insert(out.end(), {0, 1, 2});
+        return;
+    }
+    double normal[3] = {0, 0, 0};
+    for(int i = 0; i < n; i++) {
+        const pointr& a = positions[v[i]];
+        const pointr& b = positions[v[(i + 1) % n]];
+        normal[0] += ((double)a.y - b.y) * ((double)a.z + b.z);
+        normal[1] += ((double)a.z - b.z) * ((double)a.x + b.x);
+        normal[2] += ((double)a.x - b.x) * ((double)a.y + b.y);
+    }
+    // 去掉法线最大的分量投影到平面上，并使多边形在平面内为逆时针
+    int axis = 0;
+    for(int k = 1; k < 3; k++) if(std::abs(normal[k]) > std::abs(normal[axis])) axis = k;
+    const int iu = (axis + 1) % 3, iv = (axis + 2) % 3;
+    const double flip = normal[axis] < 0 ? -1 : 1;
+    s.u.resize(n), s.v.resize(n);
+    for(int i = 0; i < n; i++) {
+        const pointr& p = positions[v[i]];
+        s.u[i] = p[iu] * flip, s.v[i] = p[iv];
+    }
+
+    // 面积为 0 的多边形也按扇形切分
+    bool convex = true;
+    for(int i = 0; i < n && convex; i++) convex = orient(s, (i + n - 1) % n, i, (i + 1) % n) >= 0;
+    if(convex || normal[axis] == 0) {
+        for(int i = 1; i + 1 < n; i++) out.insert(out.end(), {0, i, i + 1});
+        return;
+    }
+
+    s.remaining.resize(n);
+    for(int i = 0; i < n; i++) s.remaining[i] = i;
+    for(int m = n; m > 3; m--) {
+        int ear = 0;
+        for(int k = 0; k < m; k++) {
+            const int a = s.remaining[(k + m - 1) % m], b = s.remaining[k], c = s.remaining[(k + 1) % m];
+            if(orient(s, a, b, c) <= 0) continue;
+            bool empty = true;
+            for(int j = 0; j < m && empty; j++) {
+                const int p = s.remaining[j];
+                if(p == a || p == b || p == c) continue;
+                // 与三角形顶点重合的点不算在内部
+                if((s.u[p] == s.u[a] && s.v[p] == s.v[a]) || (s.u[p] == s.u[b] && s.v[p] == s.v[b]) || (s.u[p] == s.u[c] && s.v[p] == s.v[c])) continue;
+                empty = !(orient(s, a, b, p) >= 0 && orient(s, b, c, p) >= 0 && orient(s, c, a, p) >= 0);
+            }
+            if(empty) {
+                ear = k;
+                break;
+            }
+        }
+        out.insert(out.end(), {s.remaining[(ear + m - 1) % m], s.remaining[ear], s.remaining[(ear + 1) % m]});
+        s.remaining.erase(s.remaining.begin() + ear);
+    }
+    out.insert(out.end(), {s.remaining[0], s.remaining[1], s.remaining[2]});
+}
+
+// 按顺序检查各段的下标并拼接，结果与把整段文本一次解析完全相同。
+// 先拼接属性，再由各段把自己的面三角化后直接写到输出中的位置
+static bool merge_chunks(std::vector<ObjChunk>& chunks, ObjData& out, std::string& error, ThreadPool* pool) {
+    struct Base { size_t count[3], corners, faces, lines; };
+    std::vector<Base> bases(chunks.size());
+    Base total = {{0, 0, 0}, 0, 0, 0};
+    for(size_t c = 0; c < chunks.size(); c++) {
+        const ObjChunk& chunk = chunks[c];
+        bases[c] = total;
+        if(!chunk.error.empty()) {
+            error = "line " + std::to_string(total.lines + chunk.error_line) + ": " + chunk.error;
+            return false;
+        }
+        for(int a = 0; a < 3; a++) {
+            const long long count = (long long)total.count[a];
+            if(chunk.max_ahead[a] >= count || chunk.min_relative[a] < -count) {
+                size_t line = chunk.max_ahead[a] >= count ? chunk.ahead_line[a] : chunk.relative_line[a];
+                error = "line " + std::to_string(total.lines + line) + ": " + index_errors[a];
+                return false;
+            }
+        }
+        const ObjData& d = chunk.data;
+        total.count[0] += d.positions.size(), total.count[1] += d.uvs.size(), total.count[2] += d.normals.size();
+        total.corners += chunk.triangle_corners, total.faces += d.face_size.size(), total.lines += chunk.lines;
+    }
+
+    out.positions.resize(total.count[0]), out.uvs.resize(total.count[1]), out.normals.resize(total.count[2]);
+    out.corner_v.resize(total.corners), out.corner_vt.resize(total.corners), out.corner_vn.resize(total.corners);
+    out.face_size.resize(total.faces);
+    auto copy = [&](size_t c) {
+        ObjData& d = chunks[c].data;
+        const Base& b = bases[c];
+        std::vector<int>* corners[3] = {&d.corner_v, &d.corner_vt, &d.corner_vn};
+        for(int a = 0; a < 3; a++)
+            for(size_t i: chunks[c].relative[a]) (*corners[a])[i] += (int)b.count[a];
+        std::copy(d.positions.begin(), d.positions.end(), out.positions.begin() + b.count[0]);
+        std::copy(d.uvs.begin(), d.uvs.end(), out.uvs.begin() + b.count[1]);
+        std::copy(d.normals.begin(), d.normals.end(), out.normals.begin() + b.count[2]);
+        std::copy(d.face_size.begin(), d.face_size.end(), out.face_size.begin() + b.faces);
+    };
+    auto emit = [&](size_t c) {
+        ObjData& d = chunks[c].data;
+        size_t o = bases[c].corners;
+        if(!chunks[c].polygons) {
+            std::copy(d.corner_v.begin(), d.corner_v.end(), out.corner_v.begin() + o);
+            std::copy(d.corner_vt.begin(), d.corner_vt.end(), out.corner_vt.begin() + o);
+            std::copy(d.corner_vn.begin(), d.corner_vn.end(), out.corner_vn.begin() + o);
+        }
+        else {
+            PolygonScratch scratch;
+            std::vector<int> triangles;
+            size_t first = 0;
+            for(int n: d.face_size) {
+                triangles.clear();
+                triangulate(out.positions, &d.corner_v[first], n, triangles, scratch);
+                for(int k: triangles) {
+                    out.corner_v[o] = d.corner_v[first + k];
+                    out.corner_vt[o] = d.corner_vt[first + k];
+                    out.corner_vn[o] = d.corner_vn[first + k];
+                    o++;
+                }
+                first += n;
+            }
+        }
+        d.clear();
+    };
+    auto run = [&](const std::function<void(size_t)>& pass) {
+        if(pool) pool->parallel_for(chunks.size(), pass);
+        else for(size_t c = 0; c < chunks.size(); c++) pass(c);
+    };
+    run(copy);
+    run(emit);
+    return true;
+}
+
+// 小于该大小的文本不切分
+constexpr size_t min_chunk_bytes = 1 << 20;
+
+bool MSRender::parse_obj(const char* begin, const char* end, ObjData& out, std::string& error, ThreadPool* pool) {
+    const size_t bytes = end - begin;
+    size_t chunk_num = pool ? std::min(pool->size() * 4, bytes / min_chunk_bytes) : 1;
+    if(chunk_num < 1) chunk_num = 1;
+    // 在行边界处切分
+    std::vector<const char*> cuts = {begin};
+    for(size_t c = 1; c < chunk_num; c++) {
+        const char* p = std::max(begin + bytes * c / chunk_num, cuts.back());
+        const char* eol = (const char*)std::memchr(p, '\n', end - p);
+        if(!eol) break;
+        cuts.push_back(eol + 1);
+    }
+    cuts.push_back(end);
+
+    std::vector<ObjChunk> chunks(cuts.size() - 1);
+    auto parse = [&](size_t c) { parse_chunk(cuts[c], cuts[c + 1], chunks[c]); };
+    if(pool && chunks.size() > 1) pool->parallel_for(chunks.size(), parse);
+    else for(size_t c = 0; c < chunks.size(); c++) parse(c);
+
+    out.clear();
+    return merge_chunks(chunks, out, error, chunks.size() > 1 ? pool : nullptr);
+}
+
+bool MSRender::load_obj(const std::string& filename, ObjData& out, std::string& error, ThreadPool* pool) {
+    FileView file;
+    if(!file.open(filename)) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    return parse_obj(file.begin(), file.end(), out, error, pool);
+}
\ No newline at end of file
@@ -1,117 +1,686 @@
 #include "rasterization.h"
 #include "global.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace MSRender;
 template<typename T, typename U>
-static inline double max(T a, U b) { return a>b?a:b; }
+static inline real max(T a, U b) { return a>b?a:b; }
 template<typename T, typename U>
-static inline double min(T a, U b) { return a<b?a:b; }
-
-struct bbox { int max_x, min_x, max_y, min_y; };
-static inline bbox get_bbox(pointd A, pointd B, pointd C) {
-    double max_x = min(W-1, max(A.x, max(B.x, C.x)));
-    double min_x = max(0,   min(A.x, min(B.x, C.x)));
-    double max_y = min(H-1, max(A.y, max(B.y, C.y)));
-    double min_y = max(0,   min(A.y, min(B.y, C.y)));
+static inline real min(T a, U b) { return a<b?a:b; }
+
+// 三角形的包围盒，限制在 [0, width-1] x [0, height-1] 内，默认为屏幕范围
+static inline bbox get_bbox(pointr A, pointr B, pointr C, int width = W, int height = H) {
+    real max_x = min(width-1,  max(A.x, max(B.x, C.x)));
+    real min_x = max(0,        min(A.x, min(B.x, C.x)));
+    real max_y = min(height-1, max(A.y, max(B.y, C.y)));
+    real min_y = max(0,        min(A.y, min(B.y, C.y)));
     return {(int)std::ceil(max_x), (int)std::floor(min_x), (int)std::ceil(max_y), (int)std::floor(min_y)};
 }
 
-static vecd barycentric(pointd A, pointd B, pointd C, pointd P) {
-    vecd x(B.x-A.x, C.x-A.x, A.x-P.x);
-    vecd y(B.y-A.y, C.y-A.y, A.y-P.y);
-    double u = (x.y*y.z - x.z*y.y) / (x.x*y.y - x.y*y.x);
-    double v = (x.x*y.z - x.z*y.x) / (x.y*y.x - x.x*y.y);
-    return vecd(1.-u-v, u, v);
+// 边函数使用 8 位亚像素精度的定点数，步进时只有整数加法，且共享边的判定是精确的
+constexpr int sub_bits = 8;
+constexpr long long sub_one = 1LL << sub_bits;
+// 超出该范围的坐标会使定点数乘积溢出
+constexpr double guard_band = double(1 << 21);
+
+struct EdgeSetup {
+    long long e[3];     // (min_x+0.5, min_y+0.5) 处的边函数值，已加上左上规则的偏置
+    long long bias[3];  // 不包含在左上规则内的边为 1，像素恰好落在该边上时判为不覆盖
+    long long step_x[3];
+    long long step_y[3];
+    double inv_area;
+
+    // e[i] 为第 i 个顶点对边的边函数，b_i = e_i / area；退化或超出范围的三角形返回 false
+    bool setup(const pointr& A, const pointr& B, const pointr& C, int min_x, int min_y) {
+        const pointr* v[3] = {&A, &B, &C};
+        long long px[3], py[3];
+        for(int i = 0; i < 3; i++) {
+            if(!(std::abs(v[i]->x) < guard_band && std::abs(v[i]->y) < guard_band)) return false;
+            px[i] = std::llround(v[i]->x * sub_one);
+            py[i] = std::llround(v[i]->y * sub_one);
+        }
+        long long cx = ((long long)min_x << sub_bits) + sub_one / 2;
+        long long cy = ((long long)min_y << sub_bits) + sub_one / 2;
+        long long area = 0;
+        for(int i = 0; i < 3; i++) {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            long long ex = px[b] - px[a], ey = py[b] - py[a];
+            e[i] = ex * (cy - py[a]) - ey * (cx - px[a]);
+            step_x[i] = -ey * sub_one;
+            step_y[i] = ex * sub_one;
+            if(i == 0) area = ex * (py[0] - py[a]) - ey * (px[0] - px[a]);
+        }
+        if(area == 0) return false;
+        // 统一为逆时针，使内部的边函数为正
+        if(area < 0) {
+            area = -area;
+            for(int i = 0; i < 3; i++) e[i] = -e[i], step_x[i] = -step_x[i], step_y[i] = -step_y[i];
+        }
+        for(int i = 0; i < 3; i++) {
+            bool top_left = step_x[i] > 0 || (step_x[i] == 0 && step_y[i] < 0);
+            bias[i] = top_left ? 0 : 1;
+            e[i] -= bias[i];
+        }
+        inv_area = 1. / (double)area;
+        return true;
+    }
+
+    static bool inside(const long long* w) { return (w[0] | w[1] | w[2]) >= 0; }
+    vecr barycentric(const long long* w) const {
+        return vecr((w[0] + bias[0]) * inv_area, (w[1] + bias[1]) * inv_area, (w[2] + bias[2]) * inv_area);
+    }
+};
+
+static inline int lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int k = 0;
+    while(!(mask & 1u)) mask >>= 1, k++;
+    return k;
+#endif
 }
 
+// less: 比已有深度更近才通过（并写入）；equal: 与预先写入的深度相等才通过（不写入）
+enum class DepthTest { less, equal };
+
+// 深度比较的舍入余量随精度变化
+constexpr real depth_margin = sizeof(real) == sizeof(float) ? 1e-5 : 1e-9;
+
+// 一行中连续 block_w 个像素为一组，一次完成覆盖测试、深度插值与深度测试
+constexpr int block_w = 8;
+
+struct BlockEval {
+    alignas(32) long long off[3][block_w]; // 组内第 k 个像素相对组首的边函数增量
+    alignas(32) real n_off[block_w];
+    alignas(32) real d_off[block_w];
+    double n_coef[3], d_coef[3], d_const;  // 逐三角形的系数保持 double，逐像素的量使用 real
+
+    // 深度 z = N / D，N、D 都是边函数的线性组合：
+    // N = sum((e_i + bias_i) * n_coef[i])，D = d_const + sum((e_i + bias_i) * d_coef[i])
+    void setup(const EdgeSetup& edge, const double* n_c, const double* d_c, double d_c0) {
+        double n_dx = 0, d_dx = 0;
+        for(int i = 0; i < 3; i++) {
+            n_coef[i] = n_c[i], d_coef[i] = d_c[i];
+            n_dx += edge.step_x[i] * n_coef[i];
+            d_dx += edge.step_x[i] * d_coef[i];
+            for(int k = 0; k < block_w; k++) off[i][k] = k * edge.step_x[i];
+        }
+        d_const = d_c0;
+        for(int k = 0; k < block_w; k++) n_off[k] = k * n_dx, d_off[k] = k * d_dx;
+    }
+
+    // w 为组首像素的边函数，zrow 指向组首像素的深度，count 为组内有效像素数。
+    // 返回通过覆盖与深度测试的像素掩码，z 中写入每个像素的深度
+    template<DepthTest test>
+    unsigned eval(const EdgeSetup& edge, const long long* w, const real* zrow, int count, real* z) const {
+        unsigned valid = (1u << count) - 1;
+        double n = 0, d = d_const;
+        for(int i = 0; i < 3; i++) {
+            n += (w[i] + edge.bias[i]) * n_coef[i];
+            d += (w[i] + edge.bias[i]) * d_coef[i];
+        }
+        alignas(32) real zb[block_w];
+        if(count < block_w) {
+            for(int k = 0; k < block_w; k++) zb[k] = k < count ? zrow[k] : std::numeric_limits<real>::infinity();
+            zrow = zb;
+        }
+#if defined(__AVX2__)
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for(int i = 0; i < 3; i++) {
+            __m256i base = _mm256_set1_epi64x(w[i]);
+            lo = _mm256_or_si256(lo, _mm256_add_epi64(base, _mm256_load_si256((const __m256i*)off[i])));
+            hi = _mm256_or_si256(hi, _mm256_add_epi64(base, _mm256_load_si256((const __m256i*)(off[i] + 4))));
+        }
+        unsigned outside = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+        unsigned mask = ~outside & valid;
+        if(!mask) return 0;
+#if defined(MSR_USE_FLOAT)
+        __m256 z8 = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(n), _mm256_load_ps(n_off)), _mm256_add_ps(_mm256_set1_ps(d), _mm256_load_ps(d_off)));
+        _mm256_storeu_ps(z, z8);
+        constexpr int cmp = test == DepthTest::less ? _CMP_LT_OQ : _CMP_EQ_OQ;
+        unsigned pass = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(zrow), z8, cmp));
+#else
+        __m256d vn = _mm256_set1_pd(n), vd = _mm256_set1_pd(d);
+        __m256d z_lo = _mm256_div_pd(_mm256_add_pd(vn, _mm256_load_pd(n_off)), _mm256_add_pd(vd, _mm256_load_pd(d_off)));
+        __m256d z_hi = _mm256_div_pd(_mm256_add_pd(vn, _mm256_load_pd(n_off + 4)), _mm256_add_pd(vd, _mm256_load_pd(d_off + 4)));
+        _mm256_storeu_pd(z, z_lo);
+        _mm256_storeu_pd(z + 4, z_hi);
+        constexpr int cmp = test == DepthTest::less ? _CMP_LT_OQ : _CMP_EQ_OQ;
+        unsigned pass = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(zrow), z_lo, cmp))
+                     | (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(zrow + 4), z_hi, cmp)) << 4);
+#endif
+        return mask & pass;
+#elif defined(__SSE2__)
+        unsigned outside = 0;
+        for(int k = 0; k < block_w; k += 2) {
+            __m128i acc = _mm_setzero_si128();
+            for(int i = 0; i < 3; i++)
+                acc = _mm_or_si128(acc, _mm_add_epi64(_mm_set1_epi64x(w[i]), _mm_load_si128((const __m128i*)(off[i] + k))));
+            outside |= _mm_movemask_pd(_mm_castsi128_pd(acc)) << k;
+        }
+        unsigned mask = ~outside & valid;
+        if(!mask) return 0;
+        unsigned pass = 0;
+#if defined(MSR_USE_FLOAT)
+        __m128 vn = _mm_set1_ps(n), vd = _mm_set1_ps(d);
+        for(int k = 0; k < block_w; k += 4) {
+            __m128 zk = _mm_div_ps(_mm_add_ps(vn, _mm_load_ps(n_off + k)), _mm_add_ps(vd, _mm_load_ps(d_off + k)));
+            _mm_storeu_ps(z + k, zk);
+            __m128 zb_k = _mm_loadu_ps(zrow + k);
+            pass |= _mm_movemask_ps(test == DepthTest::less ? _mm_cmplt_ps(zb_k, zk) : _mm_cmpeq_ps(zb_k, zk)) << k;
+        }
+#else
+        __m128d vn = _mm_set1_pd(n), vd = _mm_set1_pd(d);
+        for(int k = 0; k < block_w; k += 2) {
+            __m128d zk = _mm_div_pd(_mm_add_pd(vn, _mm_load_pd(n_off + k)), _mm_add_pd(vd, _mm_load_pd(d_off + k)));
+            _mm_storeu_pd(z + k, zk);
+            __m128d zb_k = _mm_loadu_pd(zrow + k);
+            pass |= _mm_movemask_pd(test == DepthTest::less ? _mm_cmplt_pd(zb_k, zk) : _mm_cmpeq_pd(zb_k, zk)) << k;
+        }
+#endif
+        return mask & pass;
+#else
+        unsigned mask = 0;
+        for(int k = 0; k < count; k++) {
+            long long e[3] = {w[0] + off[0][k], w[1] + off[1][k], w[2] + off[2][k]};
+            if(!EdgeSetup::inside(e)) continue;
+            z[k] = (real(n) + n_off[k]) / (real(d) + d_off[k]);
+            if(test == DepthTest::less ? zrow[k] < z[k] : zrow[k] == z[k]) mask |= 1u << k;
+        }
+        return mask;
+#endif
+    }
+};
+
 template<typename T>
-inline T interpolation(T a, T b, T c, vecd& bc) {
+inline T interpolation(T a, T b, T c, vecr& bc) {
     return a * bc[0] + b * bc[1] + c * bc[2];
 }
 
-inline std::pair<vecd, vecd> getTB(Triangle& tri, bool flag) {
-    if(!flag) return {vecd(), vecd()};
-    vecd E1    = tri[1].world_pos - tri[0].world_pos;
-    vecd E2    = tri[2].world_pos - tri[0].world_pos;
-    double du1 = tri[1].uv.u - tri[0].uv.u;
-    double dv1 = tri[1].uv.v - tri[0].uv.v;
-    double du2 = tri[2].uv.u - tri[0].uv.u;
-    double dv2 = tri[2].uv.v - tri[0].uv.v;
-    double temp = dv2 * du1 - dv1 * du2;
-    vecd T = ((E1 * dv2 - E2 * dv1) / temp).normalized();
-    vecd B = ((E2 * du1 - E1 * du2) / temp).normalized();
+inline std::pair<vecr, vecr> getTB(Triangle& tri, bool flag) {
+    if(!flag) return {vecr(), vecr()};
+    vecr E1    = tri[1].world_pos - tri[0].world_pos;
+    vecr E2    = tri[2].world_pos - tri[0].world_pos;
+    real du1 = tri[1].uv.u - tri[0].uv.u;
+    real dv1 = tri[1].uv.v - tri[0].uv.v;
+    real du2 = tri[2].uv.u - tri[0].uv.u;
+    real dv2 = tri[2].uv.v - tri[0].uv.v;
+    real temp = dv2 * du1 - dv1 * du2;
+    vecr T = ((E1 * dv2 - E2 * dv1) / temp).normalized();
+    vecr B = ((E2 * du1 - E1 * du2) / temp).normalized();
     return {T, B};
 }
 
-void MSRender::rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, double* zbuffer, Light& light, double* shadow_map) {
+// 透视校正后的 uv 是屏幕坐标的分式线性函数：u = U(x, y) / Q(x, y)，U、Q 为 u/w、1/w 的线性插值。
+// 与 GPU 一样按 2x2 像素块求差分：块内四个像素共用块左上像素与其右、下相邻像素之间的 uv 之差，
+// 块内落在三角形外的像素按平面方程外推
+struct UVGradient {
+    double x0, y0;
+    double u[3], v[3], q[3];   // 各量在 (x0, y0) 处的值及对 x、y 的偏导
+    bool valid = false;
+
+    void setup(const Triangle& tri) {
+        valid = false;
+        if(Model::texture_filter == TextureFilter::nearest) return;
+        const pointr &A = tri[0].screen_pos, &B = tri[1].screen_pos, &C = tri[2].screen_pos;
+        const double dx1 = (double)B.x - A.x, dy1 = (double)B.y - A.y;
+        const double dx2 = (double)C.x - A.x, dy2 = (double)C.y - A.y;
+        const double det = dx1 * dy2 - dx2 * dy1;
+        if(det == 0) return;
+        x0 = A.x, y0 = A.y;
+        auto plane = [&](double f0, double f1, double f2, double* out) {
+            out[0] = f0;
+            out[1] = ((f1 - f0) * dy2 - (f2 - f0) * dy1) / det;
+            out[2] = ((f2 - f0) * dx1 - (f1 - f0) * dx2) / det;
+        };
+        double q_[3], u_[3], v_[3];
+        for(int i = 0; i < 3; i++) {
+            q_[i] = 1. / tri[i].w;
+            u_[i] = tri[i].uv.u * q_[i], v_[i] = tri[i].uv.v * q_[i];
+        }
+        plane(q_[0], q_[1], q_[2], q);
+        plane(u_[0], u_[1], u_[2], u);
+        plane(v_[0], v_[1], v_[2], v);
+        valid = true;
+    }
+
+    // 像素 (x, y) 所在 2x2 块内 uv 沿 x、y 方向的差分，退化时为 0（使用第 0 层）
+    void quad(int x, int y, uvr& dx, uvr& dy) const {
+        dx = dy = uvr(0, 0);
+        if(!valid) return;
+        const double px = (x & ~1) + 0.5 - x0, py = (y & ~1) + 0.5 - y0;
+        auto at = [&](const double* f, double ox, double oy) { return f[0] + f[1] * (px + ox) + f[2] * (py + oy); };
+        const double q00 = at(q, 0, 0), q10 = at(q, 1, 0), q01 = at(q, 0, 1);
+        if(!(q00 > 0 && q10 > 0 && q01 > 0)) return;
+        const double u00 = at(u, 0, 0) / q00, v00 = at(v, 0, 0) / q00;
+        dx = uvr(at(u, 1, 0) / q10 - u00, at(v, 1, 0) / q10 - v00);
+        dy = uvr(at(u, 0, 1) / q01 - u00, at(v, 0, 1) / q01 - v00);
+    }
+};
+
+// 插值得到片元的几何属性；纹理采样、法线贴图与着色留给 shade_sample
+static GSample interpolate_sample(Triangle& tri, vecr& bc_screen, const Model& model, const UVGradient& grad, int x, int y) {
+    GSample s;
+    grad.quad(x, y, s.duv_dx, s.duv_dy);
+    s.world_pos = interpolation(tri[0].world_pos, tri[1].world_pos, tri[2].world_pos, bc_screen);
+    s.uv        = interpolation(tri[0].uv, tri[1].uv, tri[2].uv, bc_screen);
+    s.normal    = interpolation(tri[0].normal, tri[1].normal, tri[2].normal, bc_screen).normalized();
+    if(!model.has_diffuse_map())
+        s.texture = interpolation(tri[0].texture, tri[1].texture, tri[2].texture, bc_screen);
+    if(!model.has_specular_map())
+        s.specular = interpolation(tri[0].specular, tri[1].specular, tri[2].specular, bc_screen);
+    return s;
+}
+
+// 第 k 个片元的着色；m 不为空时贴图取 m 中批量采样的结果，否则逐个采样
+static TGAColor shade_sample(const GSample& s, const Model& model, const PixelShader* shader, const Lighting& lighting, int x, int y, const vecr& T, const vecr& B,
+                             const MaterialSamples* m = NULL, int k = 0) {
+    Fragment f;
+    f.world_pos = s.world_pos;
+    f.uv        = s.uv;
+    f.normal    = s.normal;
+
+    if(model.has_diffuse_map())
+        f.texture = m ? m->diffuse[k] : model.get_diffuse(f.uv, s.duv_dx, s.duv_dy);
+    else f.texture = s.texture;
+    if(model.has_specular_map())
+        f.specular = m ? m->specular[k] : model.get_specular(f.uv, s.duv_dx, s.duv_dy);
+    else f.specular = s.specular;
+    if(model.has_glow_map())
+        f.glow = m ? m->glow[k] : model.get_glow(f.uv, s.duv_dx, s.duv_dy);
+    else f.glow = vecr(0, 0, 0);
+
+    if(model.has_normal_map()) {
+        if(Model::nm_is_in_tangent){
+            vecr N = f.normal;
+            // vecr T = (U - N*(U*N)).normalized();
+            // vecr B = cross(N, T).normalized();
+            vecr nm_tan = m ? m->normal[k] : model.get_normal_with_map(f.uv, s.duv_dx, s.duv_dy);
+            f.normal = vecr(nm_tan[0] * T[0] + nm_tan[1] * B[0] + nm_tan[2] * N[0],
+                            nm_tan[0] * T[1] + nm_tan[1] * B[1] + nm_tan[2] * N[1],
+                            nm_tan[0] * T[2] + nm_tan[1] * B[2] + nm_tan[2] * N[2], 
+                            0).normalized();
+        }
+        else f.normal = m ? m->normal[k] : model.get_normal_with_map(f.uv, s.duv_dx, s.duv_dy);
+    }
+
+    // 所在 tile 的光源中，作用范围覆盖该片元的光源及其阴影系数（完全在阴影中时光照强度为 0.3）
+    const std::vector<std::uint32_t>* list = lighting.grid ? &lighting.grid->at(x, y) : NULL;
+    const size_t count = list ? list->size() : lighting.lights.size();
+    thread_local std::vector<std::uint32_t> ids;
+    thread_local std::vector<real> shadow;
+    ids.clear(), shadow.clear();
+    // 环境光的阴影系数只取投射阴影的光源的平均值，不投射阴影的光源不会冲淡主光源的阴影
+    real ambient_shadow = 0;
+    int casters = 0;
+    for(size_t i = 0; i < count; i++) {
+        const std::uint32_t id = list ? (*list)[i] : i;
+        const Light& light = lighting.lights[id];
+        const vecr to_light = light.pos - f.world_pos;
+        if(!(to_light.norm2() < light.range * light.range)) continue;
+        real lit = 1;
+        if(id < lighting.shadows.size() && lighting.shadows[id]) {
+            // 世界空间中的深度偏移，取值沿用深度范围为 2 * shadow_map_size 的单张阴影贴图中的 NDC 偏移
+            real bias = std::max(0.005, 0.05 * (1.0 - f.normal * to_light.normalized())) * 2 * shadow_map_size;
+            lit = lighting.shadows[id]->visibility(f.world_pos, bias);
+            ambient_shadow += lit + (1 - lit) * 0.3;
+            casters++;
+        }
+        ids.push_back(id);
+        shadow.push_back(lit + (1 - lit) * 0.3);
+    }
+    ambient_shadow = casters ? ambient_shadow / casters : 1;
+    return shader->shading(f, ids.data(), shadow.data(), ids.size(), ambient_shadow);
+}
+
+// 一组片元的贴图批量采样。nearest 时返回空，仍逐片元采样，与原来的结果逐位一致
+static const MaterialSamples* sample_block(const GSample* const* s, int n, const Model& model, MaterialSamples& out) {
+    if(Model::texture_filter == TextureFilter::nearest) return NULL;
+    uvr uv[block_w], dx[block_w], dy[block_w];
+    for(int k = 0; k < n; k++) uv[k] = s[k]->uv, dx[k] = s[k]->duv_dx, dy[k] = s[k]->duv_dy;
+    model.sample_materials(uv, dx, dy, n, out);
+    return &out;
+}
+
+void LightGrid::build(const std::vector<Light>& lights, const VertexShader& vertex_shader) {
+    lists.assign(tiles_x * tiles_y, {});
+    const mat4r& vp = vertex_shader.view_projection();
+    for(size_t i = 0; i < lights.size(); i++) {
+        const Light& light = lights[i];
+        // 包围球的立方体 8 个角点投影后的包围盒包含球的投影；有角点不在近平面之前时无法投影，按覆盖全屏处理
+        bool whole = !std::isfinite(light.range);
+        real min_x = std::numeric_limits<real>::infinity(), max_x = -min_x, min_y = min_x, max_y = -min_x;
+        for(int c = 0; c < 8 && !whole; c++) {
+            const pointr p(light.pos.x + (c & 1 ? light.range : -light.range), light.pos.y + (c & 2 ? light.range : -light.range),
+                           light.pos.z + (c & 4 ? light.range : -light.range), 1);
+            Vertex v;
+            v.clip_pos = vp * p;
+            if(v.clip_pos.w > -z_near) {
+                whole = true;
+                break;
+            }
+            VertexShader::viewport(v);
+            min_x = std::min(min_x, v.screen_pos.x), max_x = std::max(max_x, v.screen_pos.x);
+            min_y = std::min(min_y, v.screen_pos.y), max_y = std::max(max_y, v.screen_pos.y);
+        }
+        int tx0 = 0, tx1 = tiles_x - 1, ty0 = 0, ty1 = tiles_y - 1;
+        if(!whole) {
+            if(max_x < 0 || max_y < 0 || min_x >= W || min_y >= H) continue;
+            tx0 = std::max(0, (int)min_x / tile_size), tx1 = std::min(tiles_x - 1, (int)max_x / tile_size);
+            ty0 = std::max(0, (int)min_y / tile_size), ty1 = std::min(tiles_y - 1, (int)max_y / tile_size);
+        }
+        for(int ty = ty0; ty <= ty1; ty++)
+            for(int tx = tx0; tx <= tx1; tx++) lists[tx + ty * tiles_x].push_back(i);
+    }
+}
+
+real LightGrid::average() const {
+    size_t total = 0;
+    for(const auto& list: lists) total += list.size();
+    return lists.empty() ? 0 : (real)total / lists.size();
+}
+
+void HiZBuffer::update(const real* zbuffer, int tx, int ty) {
+    real far = std::numeric_limits<real>::infinity();
+    int x1 = std::min(W, (tx+1) * size), y1 = std::min(H, (ty+1) * size);
+    for(int y = ty * size; y < y1; y++)
+        for(int x = tx * size; x < x1; x++)
+            far = std::min(far, zbuffer[x + y * W]);
+    at(tx, ty) = far;
+}
+
+static_assert(block_w == HiZBuffer::size, "a pixel block must cover exactly one HiZ tile row");
+static_assert(tile_size % HiZBuffer::size == 0, "screen tiles must be aligned to HiZ tiles");
+static_assert(block_w <= Texture::batch, "a pixel block must fit in one texture sampling batch");
+
+// 遍历三角形在 region 内通过深度测试的片元：DepthTest::less 时写入深度并维护 HiZ，
+// interpolate 为真时对每个像素块中通过的片元调用一次 on_block(y, xs, 透视校正后的重心坐标, 个数)，
+// 便于批量采样贴图；返回通过的片元数
+template<DepthTest test, bool interpolate, typename F>
+static size_t raster_triangle(Triangle& tri, real* zbuffer, HiZBuffer* hiz, const bbox& region, F&& on_block) {
     auto [max_x, min_x, max_y, min_y] = get_bbox(tri[0].screen_pos, tri[1].screen_pos, tri[2].screen_pos);
+    max_x = std::min(max_x, region.max_x), min_x = std::max(min_x, region.min_x);
+    max_y = std::min(max_y, region.max_y), min_y = std::max(min_y, region.min_y);
+    if(max_x < min_x || max_y < min_y) return 0;
+    // 像素块与 HiZ 块对齐，多出来的像素在包围盒之外，边函数测试会将其排除
+    min_x &= ~(block_w - 1);
 
-    // std::cout<<tri[0].screen_pos<<"\n"
-    //          <<tri[1].screen_pos<<"\n"
-    //          <<tri[2].screen_pos<<"\n";
-    auto [T, B] = getTB(tri, model.has_normal_map() && Model::nm_is_in_tangent);
+    // 透视修正后的深度是重心坐标的分式线性函数，最大值在顶点处取得；加上少量余量抵消舍入误差
+    real z_bound = -std::numeric_limits<real>::infinity();
+    for(int i = 0; i < 3; i++) z_bound = std::max(z_bound, tri[i].screen_pos.z * tri[i].w);
+    z_bound += depth_margin * (1 + std::abs(z_bound));
+    if(hiz) {
+        bool occluded = true;
+        for(int ty = min_y / HiZBuffer::size; occluded && ty <= max_y / HiZBuffer::size; ty++)
+            for(int tx = min_x / HiZBuffer::size; tx <= max_x / HiZBuffer::size; tx++)
+                if(hiz->at(tx, ty) < z_bound) { occluded = false; break; }
+        if(occluded) return 0;
+    }
 
-    for(int x = min_x; x <= max_x; x++) {
-        for(int y = min_y; y <= max_y; y++){
-            vecd bc_screen = barycentric(tri[0].screen_pos, tri[1].screen_pos, tri[2].screen_pos, pointd(x+0.5, y+0.5));
-            if(bc_screen[0] < 0 || bc_screen[1] < 0 || bc_screen[2] < 0) continue;
-            
-            // 透视修正
-            double zt = bc_screen[0] / tri[0].w + bc_screen[1] / tri[1].w + bc_screen[2] / tri[2].w;
-            double z = interpolation(tri[0].screen_pos.z, tri[1].screen_pos.z, tri[2].screen_pos.z, bc_screen);
-            z = z / zt;
-            
-            bc_screen[0] /= (zt*tri[0].w);
-            bc_screen[1] /= (zt*tri[1].w);
-            bc_screen[2] /= (zt*tri[2].w);
-            
-            if(zbuffer[x + y * W] < z) {
-                zbuffer[x + y * W] = z;
-                
-                Fragment f;
-                f.world_pos = interpolation(tri[0].world_pos, tri[1].world_pos, tri[2].world_pos, bc_screen);
-                f.uv        = interpolation(tri[0].uv, tri[1].uv, tri[2].uv, bc_screen);
-                f.normal    = interpolation(tri[0].normal, tri[1].normal, tri[2].normal, bc_screen).normalized();
-                
-                if(model.has_diffuse_map())
-                    f.texture = model.get_diffuse(f.uv);
-                else f.texture = interpolation(tri[0].texture, tri[1].texture, tri[2].texture, bc_screen);
-                if(model.has_specular_map())
-                    f.specular = model.get_specular(f.uv);
-                else f.specular = interpolation(tri[0].specular, tri[1].specular, tri[2].specular, bc_screen);
-                if(model.has_glow_map())
-                    f.glow = model.get_glow(f.uv);
-                else f.glow = vecd(0, 0, 0);
-
-                if(model.has_normal_map()) {
-                    if(Model::nm_is_in_tangent){
-                        vecd N = f.normal;
-                        // vecd T = (U - N*(U*N)).normalized();
-                        // vecd B = cross(N, T).normalized();
-                        vecd nm_tan = model.get_normal_with_map(f.uv);
-                        f.normal = vecd(nm_tan[0] * T[0] + nm_tan[1] * B[0] + nm_tan[2] * N[0],
-                                        nm_tan[0] * T[1] + nm_tan[1] * B[1] + nm_tan[2] * N[1],
-                                        nm_tan[0] * T[2] + nm_tan[1] * B[2] + nm_tan[2] * N[2], 
-                                        0).normalized();
+    EdgeSetup edge;
+    if(!edge.setup(tri[0].screen_pos, tri[1].screen_pos, tri[2].screen_pos, min_x, min_y)) return 0;
+    // 透视修正：z = sum(b_i * z_i) / sum(b_i / w_i)
+    double n_c[3], d_c[3];
+    for(int i = 0; i < 3; i++) {
+        n_c[i] = tri[i].screen_pos.z * edge.inv_area;
+        d_c[i] = edge.inv_area / tri[i].w;
+    }
+    BlockEval block;
+    block.setup(edge, n_c, d_c, 0);
+
+    // 本三角形改写过最远深度的 HiZ 块，光栅化结束后统一重算
+    thread_local std::vector<char> hiz_dirty(HiZBuffer::tiles_x * HiZBuffer::tiles_y, 0);
+    thread_local std::vector<int> hiz_dirty_list;
+
+    size_t fragments = 0;
+    long long row[3] = {edge.e[0], edge.e[1], edge.e[2]};
+    for(int y = min_y; y <= max_y; y++, row[0] += edge.step_y[0], row[1] += edge.step_y[1], row[2] += edge.step_y[2]) {
+        long long w[3] = {row[0], row[1], row[2]};
+        for(int x0 = min_x; x0 <= max_x; x0 += block_w) {
+            int tile = x0 / HiZBuffer::size + y / HiZBuffer::size * HiZBuffer::tiles_x;
+            if(hiz && hiz->far_depth[tile] >= z_bound) {
+                for(int i = 0; i < 3; i++) w[i] += block.off[i][block_w-1] + edge.step_x[i];
+                continue;
+            }
+            alignas(32) real z[block_w];
+            int count = std::min(block_w, max_x - x0 + 1);
+            unsigned mask = block.eval<test>(edge, w, zbuffer + x0 + y * W, count, z);
+            int xs[block_w], passed = 0;
+            vecr bcs[block_w];
+            for(; mask; mask &= mask - 1) {
+                int k = lowest_bit(mask);
+                int x = x0 + k;
+                if constexpr(test == DepthTest::less) {
+                    if(hiz && zbuffer[x + y * W] == hiz->far_depth[tile] && !hiz_dirty[tile]) {
+                        hiz_dirty[tile] = 1;
+                        hiz_dirty_list.push_back(tile);
                     }
-                    else f.normal = model.get_normal_with_map(f.uv);
+                    zbuffer[x + y * W] = z[k];
                 }
+                if constexpr(interpolate) {
+                    long long wp[3] = {w[0] + block.off[0][k], w[1] + block.off[1][k], w[2] + block.off[2][k]};
+                    vecr bc_screen = edge.barycentric(wp);
+
+                    real zt = bc_screen[0] / tri[0].w + bc_screen[1] / tri[1].w + bc_screen[2] / tri[2].w;
+                    bc_screen[0] /= (zt*tri[0].w);
+                    bc_screen[1] /= (zt*tri[1].w);
+                    bc_screen[2] /= (zt*tri[2].w);
+                    xs[passed] = x, bcs[passed++] = bc_screen;
+                }
+                fragments++;
+            }
+            if constexpr(interpolate) if(passed) on_block(y, xs, bcs, passed);
+            for(int i = 0; i < 3; i++) w[i] += block.off[i][block_w-1] + edge.step_x[i];
+        }
+    }
+    for(int tile: hiz_dirty_list) {
+        hiz->update(zbuffer, tile % HiZBuffer::tiles_x, tile / HiZBuffer::tiles_x);
+        hiz_dirty[tile] = 0;
+    }
+    hiz_dirty_list.clear();
+    return fragments;
+}
+
+size_t MSRender::rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, real* zbuffer, const Lighting& lighting, HiZBuffer* hiz) {
+    return rasterize(tri, image, model, shader, zbuffer, lighting, hiz, bbox{W-1, 0, H-1, 0});
+}
+
+size_t MSRender::rasterize(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, real* zbuffer, const Lighting& lighting, HiZBuffer* hiz, const bbox& region) {
+    auto [T, B] = getTB(tri, model.has_normal_map() && Model::nm_is_in_tangent);
+    UVGradient grad;
+    grad.setup(tri);
+    return raster_triangle<DepthTest::less, true>(tri, zbuffer, hiz, region, [&](int y, const int* xs, vecr* bcs, int n) {
+        GSample samples[block_w];
+        const GSample* ptrs[block_w];
+        for(int k = 0; k < n; k++) samples[k] = interpolate_sample(tri, bcs[k], model, grad, xs[k], y), ptrs[k] = &samples[k];
+        MaterialSamples materials;
+        const MaterialSamples* m = sample_block(ptrs, n, model, materials);
+        for(int k = 0; k < n; k++) image.set(xs[k], y, shade_sample(samples[k], model, shader, lighting, xs[k], y, T, B, m, k));
+    });
+}
+
+size_t MSRender::rasterize_gbuffer(Triangle& tri, int tri_index, int model_index, const Model& model, GBuffer& gbuffer, real* zbuffer, HiZBuffer* hiz, const bbox& region) {
+    UVGradient grad;
+    grad.setup(tri);
+    return raster_triangle<DepthTest::less, true>(tri, zbuffer, hiz, region, [&](int y, const int* xs, vecr* bcs, int n) {
+        for(int k = 0; k < n; k++) {
+            GSample& s = gbuffer[xs[k] + y * W];
+            s = interpolate_sample(tri, bcs[k], model, grad, xs[k], y);
+            s.model = model_index;
+            s.tri = tri_index;
+        }
+    });
+}
+
+size_t MSRender::rasterize_depth(Triangle& tri, real* zbuffer, HiZBuffer* hiz, const bbox& region) {
+    return raster_triangle<DepthTest::less, false>(tri, zbuffer, hiz, region, [](int, const int*, vecr*, int) {});
+}
 
-                f.light_space_pos = light.get_light_space(f.world_pos);
-                int sx = (f.light_space_pos.x + 1)*W*0.5;
-                int sy = (f.light_space_pos.y + 1)*H*0.5;
-                double bias = std::max(0.005, 0.05 * (1.0 - f.normal * (light.pos - f.world_pos).normalized()));
-                
-                if(shadow_map[sx + sy * W] - bias > f.light_space_pos.z)
-                    image.set(x, y, shader->shading(f, 0.3));
-                else image.set(x, y, shader->shading(f, 1));
+size_t MSRender::rasterize_equal(Triangle& tri, TGAImage& image, const Model& model, const PixelShader* shader, const real* zbuffer, const Lighting& lighting,
+                                 HiZBuffer* hiz, const bbox& region, std::vector<bool>& shaded) {
+    auto [T, B] = getTB(tri, model.has_normal_map() && Model::nm_is_in_tangent);
+    UVGradient grad;
+    grad.setup(tri);
+    size_t count = 0;
+    int region_w = region.max_x - region.min_x + 1;
+    raster_triangle<DepthTest::equal, true>(tri, const_cast<real*>(zbuffer), hiz, region, [&](int y, const int* xs, vecr* bcs, int n) {
+        GSample samples[block_w];
+        const GSample* ptrs[block_w];
+        int x[block_w], m_n = 0;
+        for(int k = 0; k < n; k++) {
+            // 深度相同的多个片元只取最先提交的，与单遍前向渲染一致
+            size_t idx = (xs[k] - region.min_x) + (y - region.min_y) * region_w;
+            if(shaded[idx]) continue;
+            shaded[idx] = true;
+            x[m_n] = xs[k];
+            samples[m_n] = interpolate_sample(tri, bcs[k], model, grad, xs[k], y);
+            ptrs[m_n] = &samples[m_n];
+            m_n++;
+        }
+        MaterialSamples materials;
+        const MaterialSamples* m = sample_block(ptrs, m_n, model, materials);
+        for(int k = 0; k < m_n; k++) image.set(x[k], y, shade_sample(samples[k], model, shader, lighting, x[k], y, T, B, m, k));
+        count += m_n;
+    });
+    return count;
+}
+
+size_t MSRender::shade_gbuffer(const GBuffer& gbuffer, const std::vector<std::pair<vecr, vecr>>& tangents, const std::vector<Model>& models, TGAImage& image,
+                               const PixelShader* shader, const Lighting& lighting, const bbox& region) {
+    size_t shaded = 0;
+    for(int y = region.min_y; y <= region.max_y; y++) {
+        // 同一行中连续的、属于同一模型的像素（最多 block_w 个）一起采样贴图
+        for(int x = region.min_x; x <= region.max_x; ) {
+            const int model_index = gbuffer[x + y * W].model;
+            if(model_index < 0) {
+                x++;
+                continue;
+            }
+            const Model& model = models[model_index];
+            const GSample* run[block_w];
+            int xs[block_w], n = 0;
+            for(; x <= region.max_x && n < block_w && gbuffer[x + y * W].model == model_index; x++) xs[n] = x, run[n++] = &gbuffer[x + y * W];
+            MaterialSamples materials;
+            const MaterialSamples* m = sample_block(run, n, model, materials);
+            for(int k = 0; k < n; k++) {
+                const GSample& s = *run[k];
+                const auto& [T, B] = tangents[s.tri];
+                image.set(xs[k], y, shade_sample(s, model, shader, lighting, xs[k], y, T, B, m, k));
+                shaded++;
+            }
+        }
+    }
+    return shaded;
+}
+
+void MSRender::rasterize_tiled(const VertexBuffer& vertices, const std::vector<TriangleRef>& triangles, const std::vector<Model>& models,
+                               const PixelShader* shader, const Lighting& lighting, FrameContext& frame, ThreadPool& pool, RenderMode mode) {
+    constexpr int tiles_x = (W + tile_size - 1) / tile_size;
+    constexpr int tiles_y = (H + tile_size - 1) / tile_size;
+    // 分桶：按提交顺序把三角形下标放入其包围盒覆盖的所有 tile
+    std::vector<std::vector<int>> bins(tiles_x * tiles_y);
+    for(size_t i = 0; i < triangles.size(); i++) {
+        const std::uint32_t* v = triangles[i].v;
+        pointr A(vertices.sx[v[0]], vertices.sy[v[0]]), B(vertices.sx[v[1]], vertices.sy[v[1]]), C(vertices.sx[v[2]], vertices.sy[v[2]]);
+        auto [max_x, min_x, max_y, min_y] = get_bbox(A, B, C);
+        if(max_x < min_x || max_y < min_y) continue;
+        for(int ty = min_y / tile_size; ty <= max_y / tile_size; ty++)
+            for(int tx = min_x / tile_size; tx <= max_x / tile_size; tx++)
+                bins[tx + ty * tiles_x].push_back(i);
+    }
+    auto tile_region = [](size_t t) {
+        int tx = t % tiles_x, ty = t / tiles_x;
+        return bbox{std::min(W, (tx+1) * tile_size) - 1, tx * tile_size,
+                    std::min(H, (ty+1) * tile_size) - 1, ty * tile_size};
+    };
+    // 延迟着色时每个三角形的切线与副切线只算一次，着色阶段按 GSample::tri 直接读取
+    std::vector<std::pair<vecr, vecr>> tangents;
+    if(mode == RenderMode::deferred) {
+        constexpr size_t chunk = 4096;
+        tangents.resize(triangles.size());
+        pool.parallel_for((triangles.size() + chunk - 1) / chunk, [&](size_t c) {
+            for(size_t i = c * chunk; i < std::min(triangles.size(), (c + 1) * chunk); i++) {
+                const Model& model = models[triangles[i].model];
+                if(!model.has_normal_map() || !Model::nm_is_in_tangent) continue;
+                Triangle tri = vertices.triangle(triangles[i], model);
+                tangents[i] = getTB(tri, true);
+            }
+        });
+    }
+    // 每个 tile 独占自己那一块 zbuffer、image 与 gbuffer，不需要加锁；三角形在用到时才组装
+    pool.parallel_for(bins.size(), [&](size_t t) {
+        bbox region = tile_region(t);
+        size_t fragments = 0, shaded = 0;
+        auto assemble = [&](int i) { return vertices.triangle(triangles[i], models[triangles[i].model]); };
+        if(mode == RenderMode::zprepass) {
+            for(int i: bins[t]) {
+                Triangle tri = assemble(i);
+                fragments += rasterize_depth(tri, frame.zbuffer, frame.hiz, region);
+            }
+            std::vector<bool> shaded_mask((region.max_x - region.min_x + 1) * (region.max_y - region.min_y + 1), false);
+            for(int i: bins[t]) {
+                Triangle tri = assemble(i);
+                shaded += rasterize_equal(tri, frame.image, models[triangles[i].model], shader, frame.zbuffer, lighting, frame.hiz, region, shaded_mask);
+            }
+        }
+        else if(mode == RenderMode::deferred) {
+            for(int i: bins[t]) {
+                Triangle tri = assemble(i);
+                fragments += rasterize_gbuffer(tri, i, triangles[i].model, models[triangles[i].model], *frame.gbuffer, frame.zbuffer, frame.hiz, region);
             }
+            shaded = shade_gbuffer(*frame.gbuffer, tangents, models, frame.image, shader, lighting, region);
+        }
+        else {
+            for(int i: bins[t]) {
+                Triangle tri = assemble(i);
+                fragments += rasterize(tri, frame.image, models[triangles[i].model], shader, frame.zbuffer, lighting, frame.hiz, region);
+            }
+            shaded = fragments;
+        }
+        if(frame.stats) {
+            frame.stats->fragments += fragments;
+            frame.stats->shading += shaded;
         }
+    });
+}
+
+bool MSRender::cull_frustum(const Triangle& tri, RenderStats* stats) {
+    if(stats) stats->triangles++;
+    // 可见区域内 w < 0，裁剪空间中六个平面内侧满足：
+    // |x| <= -w, |y| <= -w, w <= z <= 0
+    unsigned outside = 0x3f;
+    for(int i = 0; i < 3; i++) {
+        const pointr& c = tri.vertex[i].clip_pos;
+        unsigned code = 0;
+        if(c.x - c.w < 0) code |= 1;
+        if(-c.w - c.x < 0) code |= 2;
+        if(c.y - c.w < 0) code |= 4;
+        if(-c.w - c.y < 0) code |= 8;
+        if(c.z - c.w < 0) code |= 16;
+        if(c.z > 0) code |= 32;
+        outside &= code;
+    }
+    if(outside && stats) stats->culled_frustum++;
+    return outside;
+}
+
+bool MSRender::cull_backface(const Triangle& tri, RenderStats* stats) {
+    // 屏幕空间（y 轴向上）中正面为逆时针
+    const pointr& a = tri.vertex[0].screen_pos;
+    const pointr& b = tri.vertex[1].screen_pos;
+    const pointr& c = tri.vertex[2].screen_pos;
+    if((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y) <= 0) {
+        if(stats) stats->culled_backface++;
+        return true;
     }
+    return false;
 }
 
-void MSRender::draw_zbuffer(double* zbuffer, TGAImage &image, TGAColor color) {
-    double z_min = -1, z_max = -1;
+void MSRender::draw_zbuffer(real* zbuffer, TGAImage &image, TGAColor color) {
+    real z_min = -1, z_max = -1;
     bool flag = true;
     for(int i = 0; i < H*W; i++){
         if(zbuffer[i] > -z_far-1) {
@@ -122,7 +691,7 @@ void MSRender::draw_zbuffer(double* zbuffer, TGAImage &image, TGAColor color) {
     for(int i = 0; i < H*W; i++) zbuffer[i] = (zbuffer[i] - z_min) / (z_max - z_min);
     for(int i = 0; i < image.get_width(); i++) {
         for(int j = 0; j < image.get_height(); j++) {
-            double z=zbuffer[i+j*image.get_width()];
+            real z=zbuffer[i+j*image.get_width()];
             if(z >= 0){
                 image.set(i, j, color*z);
             }
@@ -130,19 +699,34 @@ void MSRender::draw_zbuffer(double* zbuffer, TGAImage &image, TGAColor color) {
     }
 }
 
-void MSRender::shadow(Triangle& tri, double* shadow_map) {
-    auto [max_x, min_x, max_y, min_y] = get_bbox(tri[0].light_space_pos, tri[1].light_space_pos, tri[2].light_space_pos);
+void MSRender::shadow(const pointr* v, real* depth, int stride, const bbox& region) {
+    // 阴影贴图可能比屏幕大，包围盒只按 region 限制
+    auto [max_x, min_x, max_y, min_y] = get_bbox(v[0], v[1], v[2], region.max_x + 1, region.max_y + 1);
+    max_x = std::min(max_x, region.max_x), min_x = std::max(min_x, region.min_x);
+    max_y = std::min(max_y, region.max_y), min_y = std::max(min_y, region.min_y);
+
+    EdgeSetup edge;
+    if(max_x < min_x || max_y < min_y) return;
+    if(!edge.setup(v[0], v[1], v[2], min_x, min_y)) return;
+    // 正交投影，深度直接线性插值
+    double n_c[3], d_c[3] = {0, 0, 0};
+    for(int i = 0; i < 3; i++) n_c[i] = v[i].z * edge.inv_area;
+    BlockEval block;
+    block.setup(edge, n_c, d_c, 1);
 
-    for(int x = min_x; x <= max_x; x++) {
-        for(int y = min_y; y <= max_y; y++){
-            vecd bc_screen = barycentric(tri[0].light_space_pos, tri[1].light_space_pos, tri[2].light_space_pos, pointd(x+0.5, y+0.5));
-            if(bc_screen[0] < 0 || bc_screen[1] < 0 || bc_screen[2] < 0) continue;
-            
-            double z = interpolation(tri[0].light_space_pos.z, tri[1].light_space_pos.z, tri[2].light_space_pos.z, bc_screen);
-            
-            if(shadow_map[x + y * W] < z) {
-                shadow_map[x + y * W] = z;
+    long long row[3] = {edge.e[0], edge.e[1], edge.e[2]};
+    for(int y = min_y; y <= max_y; y++, row[0] += edge.step_y[0], row[1] += edge.step_y[1], row[2] += edge.step_y[2]) {
+        long long w[3] = {row[0], row[1], row[2]};
+        real* drow = depth + (y - region.min_y) * stride;
+        for(int x0 = min_x; x0 <= max_x; x0 += block_w) {
+            alignas(32) real z[block_w];
+            int count = std::min(block_w, max_x - x0 + 1);
+            unsigned mask = block.eval<DepthTest::less>(edge, w, drow + (x0 - region.min_x), count, z);
+            for(; mask; mask &= mask - 1) {
+                int k = lowest_bit(mask);
+                drow[x0 - region.min_x + k] = z[k];
             }
+            for(int i = 0; i < 3; i++) w[i] += block.off[i][block_w-1] + edge.step_x[i];
         }
     }
 }
\ No newline at end of file
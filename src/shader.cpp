@@ -2,32 +2,42 @@
 
 using namespace MSRender;
 
-TGAColor PhongShader::shading(const Fragment& fragment, double shadow) const {
-    pointd result(0.,0.,0.);
+TGAColor PhongShader::shading(const Fragment& fragment, const std::uint32_t* ids, const real* shadow, int n, real ambient_shadow) const {
+    pointr result(0.,0.,0.);
     
-    pointd la(ka*amb_light_intensity, ka*amb_light_intensity, ka*amb_light_intensity);
+    // 环境光与自发光按 ambient_shadow 衰减，各光源按各自的阴影系数衰减
+    real ambient = ka*amb_light_intensity*ambient_shadow;
+    pointr la(ambient, ambient, ambient);
     result += la;
 
-    vecd kd(fragment.texture[0]/255., fragment.texture[1]/255., fragment.texture[2]/255.);
-    double ks = fragment.specular/255.;
-    result += fragment.glow*amb_light_intensity;
+    vecr kd(fragment.texture[0]/255., fragment.texture[1]/255., fragment.texture[2]/255.);
+    real ks = fragment.specular/255.;
+    result += fragment.glow*(amb_light_intensity*ambient_shadow);
 
-    for(auto& light: lights) {
-        vecd light_dir = light.pos - fragment.world_pos;
-        vecd eye_dir = eye_pos - fragment.world_pos;
-        double r2 = light_dir.norm2();
+    for(int i = 0; i < n; i++) {
+        const Light& light = lights[ids[i]];
+        vecr light_dir = light.pos - fragment.world_pos;
+        vecr eye_dir = eye_pos - fragment.world_pos;
+        real r2 = light_dir.norm2();
 
-        vecd ld(kd[0]*light.intensity/r2, kd[1]*light.intensity/r2, kd[2]*light.intensity/r2);
-        ld *= std::max(0., fragment.normal * light_dir.normalized());
+        vecr ld(kd[0]*light.intensity/r2, kd[1]*light.intensity/r2, kd[2]*light.intensity/r2);
+        ld *= std::max<real>(0, fragment.normal * light_dir.normalized());
 
-        vecd ls(ks*light.intensity/r2, ks*light.intensity/r2, ks*light.intensity/r2);
-        ls *= std::pow(std::max(0., fragment.normal * (light_dir + eye_dir).normalized()), p);
+        vecr ls(ks*light.intensity/r2, ks*light.intensity/r2, ks*light.intensity/r2);
+        ls *= std::pow(std::max<real>(0, fragment.normal * (light_dir + eye_dir).normalized()), p);
 
-        result += (ld + ls)*255.;
+        vecr c = (ld + ls)*255.;
+        if(std::isfinite(light.range)) {
+            real x = r2 / (light.range * light.range);
+            real window = std::max<real>(0, 1 - x * x);
+            c *= window * window;
+        }
+        c = vecr(c[0]*(light.color[2]/255.), c[1]*(light.color[1]/255.), c[2]*(light.color[0]/255.), 0);
+        result += c*shadow[i];
     }
-    return TGAColor((std::uint8_t) std::min(255., result[0]*shadow),
-                    (std::uint8_t) std::min(255., result[1]*shadow),
-                    (std::uint8_t) std::min(255., result[2]*shadow));
+    return TGAColor((std::uint8_t) std::min<real>(255, result[0]),
+                    (std::uint8_t) std::min<real>(255, result[1]),
+                    (std::uint8_t) std::min<real>(255, result[2]));
 }
 
 VertexShader::VertexShader() {
@@ -36,16 +46,16 @@ VertexShader::VertexShader() {
     vp = projection_matrix * view_matrix;
 }
 
-void VertexShader::set_view_matrix(const pointd& eye_pos, const vecd& eye_up_dir, const pointd& center) {
-    vecd z = (eye_pos - center).normalized();
-    vecd x = cross(eye_up_dir, z).normalized();
-    vecd y = cross(z, x).normalized();
+void VertexShader::set_view_matrix(const pointr& eye_pos, const vecr& eye_up_dir, const pointr& center) {
+    vecr z = (eye_pos - center).normalized();
+    vecr x = cross(eye_up_dir, z).normalized();
+    vecr y = cross(z, x).normalized();
     
-    mat4d T(true);
+    mat4r T(true);
     T[0][3] = -eye_pos.x;
     T[1][3] = -eye_pos.y;
     T[2][3] = -eye_pos.z;
-    mat4d R;
+    mat4r R;
     R[0][0] = x.x, R[0][1] = x.y, R[0][2] = x.z;
     R[1][0] = y.x, R[1][1] = y.y, R[1][2] = y.z;
     R[2][0] = z.x, R[2][1] = z.y, R[2][2] = z.z;
@@ -53,20 +63,20 @@ void VertexShader::set_view_matrix(const pointd& eye_pos, const vecd& eye_up_dir
     view_matrix = R*T;
 }
 
-void VertexShader::set_projection_matrix(double eye_fov, double aspect_ratio, double z_near, double z_far) {
-    double n = -z_near, f = -z_far;
-    double t = std::abs(n) * std::tan(eye_fov * 0.5 * PI / 360);
-    double b = -t;
-    double r = aspect_ratio * t;
-    double l = -r;
+void VertexShader::set_projection_matrix(real eye_fov, real aspect_ratio, real z_near, real z_far) {
+    real n = -z_near, f = -z_far;
+    real t = std::abs(n) * std::tan(eye_fov * 0.5 * PI / 360);
+    real b = -t;
+    real r = aspect_ratio * t;
+    real l = -r;
     
-    mat4d persp_to_ortho;
+    mat4r persp_to_ortho;
     persp_to_ortho[0][0] = n;
     persp_to_ortho[1][1] = n;
     persp_to_ortho[2][2] = n+f;
     persp_to_ortho[2][3] = -n*f;
     persp_to_ortho[3][2] = 1;
-    mat4d ortho;
+    mat4r ortho;
     ortho[0][0] = 2 / (r-l); ortho[0][3] = (r+l) / (l-r);
     ortho[1][1] = 2 / (t-b); ortho[1][3] = (t+b) / (b-t);
     ortho[2][2] = 1 / (n-f); ortho[2][3] = f / (f-n);
@@ -76,37 +86,215 @@ void VertexShader::set_projection_matrix(double eye_fov, double aspect_ratio, do
 }
 
 Vertex VertexShader::shading(const Model& model, const size_t iface, const size_t nthvert) {
+    return shading(model, model.get_index(iface, nthvert));
+}
+
+Vertex VertexShader::shading(const Model& model, const size_t index) {
     Vertex ret;
-    ret.world_pos = model.model_transf(model.get_vertex(iface, nthvert));
-    auto temp = vp * ret.world_pos;
-    ret.screen_pos = pointd((temp.x/temp.w+1)*W*0.5, (temp.y/temp.w+1)*H*0.5, temp.z/temp.w, 1);
-    // 透视纠正使用距离的关系，w 需要表示距离，为正数
-    ret.w = std::abs(temp.w);
-    ret.uv = model.get_uv(iface, nthvert);
-    ret.normal =model.model_nm_transf(model.get_normal(iface, nthvert));
-    if(!model.has_diffuse_map()) ret.texture = pointd(255, 255, 255) * 0.5;
-    if(!model.has_specular_map()) ret.specular = 0;
+    ret.world_pos = model.model_transf(model.get_vertex(index));
+    ret.clip_pos = vp * ret.world_pos;
+    viewport(ret);
+    ret.uv = model.get_uv(index);
+    ret.normal =model.model_nm_transf(model.get_normal(index));
+    material(model, ret);
+    return ret;
+}
+
+void VertexShader::shading(const Model& model, size_t begin, size_t end, VertexBatch& out) const {
+    if(begin >= end) return;
+    const size_t n = end - begin;
+    const Vec3Stream& pos = model.get_positions();
+    const Vec3Stream& nm = model.get_normals();
+    // 模型矩阵是仿射变换，世界坐标的 w 恒为 1，只需要前三行
+    real* world[3] = {&out.world.x[begin], &out.world.y[begin], &out.world.z[begin]};
+    simd::mat4_mul_points(model.model_matrix.elements(), &pos.x[begin], &pos.y[begin], &pos.z[begin], real(1), n, world, 3);
+    real* clip[4] = {&out.cx[begin], &out.cy[begin], &out.cz[begin], &out.cw[begin]};
+    simd::mat4_mul_points(vp.elements(), world[0], world[1], world[2], real(1), n, clip, 4);
+    real* normal[3] = {&out.normal.x[begin], &out.normal.y[begin], &out.normal.z[begin]};
+    simd::mat4_mul_points(model.normal_matrix.elements(), &nm.x[begin], &nm.y[begin], &nm.z[begin], real(0), n, normal, 3);
+    simd::normalize3(normal[0], normal[1], normal[2], n);
+    // 与 viewport() 的运算顺序一致
+    for(size_t i = begin; i < end; i++) {
+        out.sx[i] = (out.cx[i] / out.cw[i] + 1) * W * 0.5;
+        out.sy[i] = (out.cy[i] / out.cw[i] + 1) * H * 0.5;
+        out.sz[i] = out.cz[i] / out.cw[i];
+        out.w[i] = std::abs(out.cw[i]);
+    }
+}
+
+void VertexBatch::resize(size_t n) {
+    for(auto* a: {&cx, &cy, &cz, &cw, &sx, &sy, &sz, &w}) a->resize(n);
+    world.resize(n);
+    normal.resize(n);
+}
+
+Vertex VertexBatch::get(size_t i) const {
+    Vertex ret;
+    ret.clip_pos = pointr(cx[i], cy[i], cz[i], cw[i]);
+    ret.screen_pos = pointr(sx[i], sy[i], sz[i], 1);
+    ret.w = w[i];
+    ret.world_pos = pointr(world.x[i], world.y[i], world.z[i], 1);
+    ret.normal = vecr(normal.x[i], normal.y[i], normal.z[i], 0);
+    return ret;
+}
+
+void VertexShader::material(const Model& model, Vertex& v) {
+    if(!model.has_diffuse_map()) v.texture = pointr(255, 255, 255) * 0.5;
+    if(!model.has_specular_map()) v.specular = 0;
+}
+
+size_t VertexBuffer::bytes() const {
+    return size() * (4 * sizeof(real) + 8 * sizeof(float));
+}
+
+void VertexBuffer::reserve(size_t n) {
+    for(auto* a: {&sx, &sy, &sz, &w}) a->reserve(n);
+    for(auto* a: {&wx, &wy, &wz, &nx, &ny, &nz, &u, &v}) a->reserve(n);
+}
+
+void VertexBuffer::resize(size_t n) {
+    for(auto* a: {&sx, &sy, &sz, &w}) a->resize(n);
+    for(auto* a: {&wx, &wy, &wz, &nx, &ny, &nz, &u, &v}) a->resize(n);
+}
+
+void VertexBuffer::set(std::uint32_t i, const Vertex& vert) {
+    sx[i] = vert.screen_pos.x, sy[i] = vert.screen_pos.y, sz[i] = vert.screen_pos.z;
+    w[i] = vert.w;
+    wx[i] = vert.world_pos.x, wy[i] = vert.world_pos.y, wz[i] = vert.world_pos.z;
+    nx[i] = vert.normal.x, ny[i] = vert.normal.y, nz[i] = vert.normal.z;
+    u[i] = vert.uv.u, v[i] = vert.uv.v;
+}
+
+std::uint32_t VertexBuffer::push(const Vertex& vert) {
+    std::uint32_t i = size();
+    resize(i + 1);
+    set(i, vert);
+    return i;
+}
+
+Vertex VertexBuffer::get(std::uint32_t i, const Model& model) const {
+    Vertex ret;
+    ret.screen_pos = pointr(sx[i], sy[i], sz[i], 1);
+    ret.w = w[i];
+    ret.world_pos = pointr(wx[i], wy[i], wz[i], 1);
+    ret.normal = vecr(nx[i], ny[i], nz[i], 0);
+    ret.uv = uvr(u[i], v[i]);
+    VertexShader::material(model, ret);
     return ret;
 }
 
-void Light::set_light_space_matrix(vecd center, vecd up, double r) {
-    vecd z = (pos - center).normalized();
-    vecd x = cross(up, z).normalized();
-    vecd y = cross(z, x).normalized();
+Triangle VertexBuffer::triangle(const TriangleRef& ref, const Model& model) const {
+    Triangle tri;
+    for(int j = 0; j < 3; j++) tri.vertex[j] = get(ref.v[j], model);
+    return tri;
+}
+
+void VertexShader::viewport(Vertex& v) {
+    const pointr& temp = v.clip_pos;
+    v.screen_pos = pointr((temp.x/temp.w+1)*W*0.5, (temp.y/temp.w+1)*H*0.5, temp.z/temp.w, 1);
+    // 透视纠正使用距离的关系，w 需要表示距离，为正数
+    v.w = std::abs(temp.w);
+}
+
+// 裁剪空间中可见区域 w < 0，六个平面内侧满足 |x| <= -w, |y| <= -w, w <= z <= 0，
+// plane_distance 返回值非负表示在平面内侧
+static inline real plane_distance(const pointr& c, int plane) {
+    switch(plane) {
+        case 0: return c.z - c.w;   // 近平面
+        case 1: return -c.z;        // 远平面
+        case 2: return c.x - c.w;
+        case 3: return -c.w - c.x;
+        case 4: return c.y - c.w;
+        default: return -c.w - c.y;
+    }
+}
+
+// 顶点之间的属性在裁剪空间中线性插值
+static Vertex lerp_vertex(const Vertex& a, const Vertex& b, real t) {
+    Vertex v;
+    v.clip_pos        = a.clip_pos + (b.clip_pos - a.clip_pos) * t;
+    v.world_pos       = a.world_pos + (b.world_pos - a.world_pos) * t;
+    v.normal          = a.normal + (b.normal - a.normal) * t;
+    v.uv              = uvr(a.uv.u + (b.uv.u - a.uv.u) * t, a.uv.v + (b.uv.v - a.uv.v) * t);
+    v.texture         = a.texture + (b.texture - a.texture) * t;
+    v.glow            = a.glow + (b.glow - a.glow) * t;
+    v.specular        = a.specular + (b.specular - a.specular) * t;
+    return v;
+}
+
+// 超出该范围（NDC 单位）的顶点会让光栅化的定点数溢出，需要裁剪侧面
+constexpr real guard_band = 64.;
+
+unsigned MSRender::clip_planes(const Triangle& tri, bool clip_sides) {
+    bool outside_guard = false;
+    unsigned outside = 0;
+    for(int i = 0; i < 3; i++) {
+        const pointr& c = tri.vertex[i].clip_pos;
+        for(int p = 0; p < 6; p++)
+            if(plane_distance(c, p) < 0) outside |= 1u << p;
+        if(std::abs(c.x) > -c.w * guard_band || std::abs(c.y) > -c.w * guard_band) outside_guard = true;
+    }
+    if(!clip_sides && !outside_guard) outside &= 3u;
+    return outside;
+}
+
+int MSRender::clip_triangle(const Triangle& tri, Triangle* out, bool clip_sides) {
+    unsigned outside = clip_planes(tri, clip_sides);
+    if(!outside) {
+        out[0] = tri;
+        return 1;
+    }
+
+    // 凸多边形每经过一个平面最多增加一个顶点
+    Vertex poly[2][9];
+    int n = 3;
+    for(int i = 0; i < 3; i++) poly[0][i] = tri.vertex[i];
+    int cur = 0;
+    for(int p = 0; p < 6 && n > 0; p++) {
+        if(!(outside >> p & 1u)) continue;
+        const Vertex* in = poly[cur];
+        Vertex* res = poly[cur ^ 1];
+        int m = 0;
+        for(int i = 0; i < n; i++) {
+            const Vertex& a = in[i];
+            const Vertex& b = in[(i + 1) % n];
+            real da = plane_distance(a.clip_pos, p), db = plane_distance(b.clip_pos, p);
+            if(da >= 0) res[m++] = a;
+            if((da >= 0) != (db >= 0)) res[m++] = lerp_vertex(a, b, da / (da - db));
+        }
+        n = m;
+        cur ^= 1;
+    }
+    if(n < 3) return 0;
+
+    Vertex* poly_out = poly[cur];
+    for(int i = 0; i < n; i++) VertexShader::viewport(poly_out[i]);
+    for(int i = 1; i + 1 < n; i++) {
+        out[i-1].vertex[0] = poly_out[0];
+        out[i-1].vertex[1] = poly_out[i];
+        out[i-1].vertex[2] = poly_out[i+1];
+    }
+    return n - 2;
+}
+
+void Light::set_light_space_matrix(vecr center, vecr up, real r) {
+    vecr z = (pos - center).normalized();
+    vecr x = cross(up, z).normalized();
+    vecr y = cross(z, x).normalized();
     
-    mat4d T(true);
+    mat4r T(true);
     T[0][3] = -pos.x;
     T[1][3] = -pos.y;
     T[2][3] = -pos.z;
-    mat4d R;
+    mat4r R;
     R[0][0] = x.x, R[0][1] = x.y, R[0][2] = x.z;
     R[1][0] = y.x, R[1][1] = y.y, R[1][2] = y.z;
     R[2][0] = z.x, R[2][1] = z.y, R[2][2] = z.z;
     R[3][3] = 1.; 
-    // view_matrix = R*T;
+    view_matrix = R*T;
 
-    double n = 0, f = -2*r, l = -r, t = r, b = - t;
-    mat4d ortho;
+    real n = 0, f = -2*r, l = -r, t = r, b = - t;
+    mat4r ortho;
     ortho[0][0] = 2 / (r-l); ortho[0][3] = (r+l) / (l-r);
     ortho[1][1] = 2 / (t-b); ortho[1][3] = (t+b) / (b-t);
     ortho[2][2] = 1 / (n-f); ortho[2][3] = f / (f-n);
@@ -115,7 +303,7 @@ void Light::set_light_space_matrix(vecd center, vecd up, double r) {
     light_space_matrix = ortho * R * T;
 }
 
-pointd Light::get_light_space(pointd p) {
+pointr Light::get_light_space(pointr p) {
     auto temp = light_space_matrix * p;
-    return pointd(temp.x/temp.w, temp.y/temp.w, temp.z/temp.w, 1);
+    return pointr(temp.x/temp.w, temp.y/temp.w, temp.z/temp.w, 1);
 }
\ No newline at end of file
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "shadowmap.h"
+#include "global.h"
+#include "shader.h"
+#include "rasterization.h"
+#include "threadpool.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace MSRender;
+
+ShadowFilter ShadowMap::filter = ShadowFilter::hard;
+real ShadowMap::filter_radius = 1.5;
+real ShadowMap::light_size = 0.01;
+real CascadedShadowMap::split_lambda = 0.75;
+
+// pcss 的遮挡物搜索半径与半影半径的上限（纹素）
+static constexpr real max_filter_radius = 32;
+
+// 采样点相对中心的偏移（纹素），个数补齐到 8 的倍数，多出的采样点不参与计数
+struct MSRender::ShadowKernel {
+    int n;
+    alignas(32) float dx[32], dy[32];
+};
+
+static ShadowKernel grid_kernel(int r) {
+    ShadowKernel k{0, {}, {}};
+    for(int y = -r; y <= r; y++)
+        for(int x = -r; x <= r; x++) k.dx[k.n] = x, k.dy[k.n++] = y;
+    return k;
+}
+
+// 单位圆内依次取与已有点最远的候选点得到的泊松圆盘，前 16 个点本身也是一组分布均匀的泊松圆盘
+static ShadowKernel poisson_kernel(int n) {
+    static const float dx[32] = {-0.1738f, 0.5804f, -0.5945f, 0.8573f, -0.9768f, 0.4656f, 0.0195f, -0.7004f, -0.1254f, -0.0398f, 0.9357f, -0.4533f, 0.3368f, 0.4760f, -0.9111f, -0.5885f,
+                                 0.1605f, 0.7295f, 0.1921f, -0.3138f, -0.9021f, -0.3299f, -0.0519f, 0.6468f, 0.2891f, 0.4620f, -0.3821f, -0.5938f, 0.7717f, 0.1750f, 0.9737f, -0.7468f};
+    static const float dy[32] = {0.3473f, -0.8101f, -0.6695f, 0.2175f, 0.0499f, 0.8212f, -0.3260f, 0.6840f, 0.9367f, -0.9052f, -0.3497f, -0.1101f, 0.0985f, -0.3701f, -0.3508f, 0.2934f,
+                                 0.5377f, 0.5828f, -0.6270f, -0.4551f, 0.4074f, 0.6590f, 0.0235f, -0.0351f, -0.9396f, 0.4041f, -0.9239f, -0.3750f, -0.5925f, 0.8630f, -0.0713f, -0.1266f};
+    ShadowKernel k{n, {}, {}};
+    std::copy(dx, dx + n, k.dx);
+    std::copy(dy, dy + n, k.dy);
+    return k;
+}
+
+static const ShadowKernel pcf3x3 = grid_kernel(1), pcf5x5 = grid_kernel(2);
+static const ShadowKernel poisson16 = poisson_kernel(16), poisson32 = poisson_kernel(32);
+
+// depth16 中 0 保留给“没有遮挡物”，NDC 深度 [-1, 1] 量化到 [1, 65535]
+static constexpr real depth16_scale = 65534;
+
+static std::uint16_t encode16(real z) {
+    return (std::uint16_t)(std::lround((std::clamp<real>(z, -1, 1) + 1) * 0.5 * depth16_scale) + 1);
+}
+
+ShadowMap::ShadowMap(int size, ShadowFormat format) : size_(size), format_(format) {
+    if(format_ == ShadowFormat::float32) depth32.resize((size_t)size * size);
+    // gather 按 32 位读取 16 位深度，末尾多留一个元素避免越界
+    else depth16.resize((size_t)size * size + 1);
+    clear();
+}
+
+void ShadowMap::clear() {
+    std::fill(depth32.begin(), depth32.end(), -std::numeric_limits<float>::infinity());
+    std::fill(depth16.begin(), depth16.end(), 0);
+}
+
+real ShadowMap::depth(int x, int y) const {
+    if(x < 0 || y < 0 || x >= size_ || y >= size_) return -std::numeric_limits<real>::infinity();
+    const size_t i = (size_t)x + (size_t)y * size_;
+    if(format_ == ShadowFormat::float32) return depth32[i];
+    return depth16[i] ? (depth16[i] - 1) / depth16_scale * 2 - 1 : -std::numeric_limits<real>::infinity();
+}
+
+int ShadowMap::occluders(const ShadowKernel& kernel, real x, real y, real scale, real ref, real* sum) const {
+    // 比较在存储格式中进行：depth16 把 ref 换算成量化后的阈值，q > t 等价于解码后的深度大于 ref
+    // 阈值不小于 0，空像素（q = 0）永远不算遮挡物
+    const std::int32_t t = format_ == ShadowFormat::depth16 ? std::max(0, (std::int32_t)std::floor((std::clamp<real>(ref, -2, 2) + 1) * 0.5 * depth16_scale + 1)) : 0;
+    const float ref32 = (float)ref;
+    int count = 0;
+    real total = 0;
+#if defined(__AVX2__)
+    const __m256 cx = _mm256_set1_ps((float)x), cy = _mm256_set1_ps((float)y), s = _mm256_set1_ps((float)scale);
+    const __m256i size = _mm256_set1_epi32(size_), minus1 = _mm256_set1_epi32(-1);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for(int i = 0; i < kernel.n; i += 8) {
+        const __m256i ix = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(cx, _mm256_mul_ps(_mm256_load_ps(kernel.dx + i), s))));
+        const __m256i iy = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(cy, _mm256_mul_ps(_mm256_load_ps(kernel.dy + i), s))));
+        // 只读取贴图范围内、且属于 kernel 的采样点，其余按未遮挡处理
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(kernel.n - i), lane);
+        valid = _mm256_and_si256(valid, _mm256_and_si256(_mm256_cmpgt_epi32(ix, minus1), _mm256_cmpgt_epi32(size, ix)));
+        valid = _mm256_and_si256(valid, _mm256_and_si256(_mm256_cmpgt_epi32(iy, minus1), _mm256_cmpgt_epi32(size, iy)));
+        const __m256i index = _mm256_add_epi32(ix, _mm256_mullo_epi32(iy, size));
+        __m256 d;
+        int mask;
+        if(format_ == ShadowFormat::float32) {
+            d = _mm256_mask_i32gather_ps(_mm256_set1_ps(-std::numeric_limits<float>::infinity()), depth32.data(), index, _mm256_castsi256_ps(valid), 4);
+            mask = _mm256_movemask_ps(_mm256_cmp_ps(d, _mm256_set1_ps(ref32), _CMP_GT_OQ));
+        }
+        else {
+            __m256i q = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)depth16.data(), index, valid, 2);
+            q = _mm256_and_si256(q, _mm256_set1_epi32(0xffff));
+            const __m256i hit = _mm256_cmpgt_epi32(q, _mm256_set1_epi32(t));
+            d = _mm256_cvtepi32_ps(q);
+            mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        }
+        if(!mask) continue;
+        count += __builtin_popcount(mask);
+        if(sum) {
+            alignas(32) float v[8];
+            _mm256_store_ps(v, d);
+            for(; mask; mask &= mask - 1) total += v[__builtin_ctz(mask)];
+        }
+    }
+#else
+    for(int i = 0; i < kernel.n; i++) {
+        const int ix = (int)std::floor((float)x + kernel.dx[i] * (float)scale), iy = (int)std::floor((float)y + kernel.dy[i] * (float)scale);
+        if(ix < 0 || iy < 0 || ix >= size_ || iy >= size_) continue;
+        const size_t index = (size_t)ix + (size_t)iy * size_;
+        if(format_ == ShadowFormat::float32) {
+            if(!(depth32[index] > ref32)) continue;
+            total += depth32[index];
+        }
+        else {
+            if(depth16[index] <= t) continue;
+            total += depth16[index];
+        }
+        count++;
+    }
+#endif
+    // depth16 累加的是量化值，换算回 NDC 深度
+    if(sum) *sum = format_ == ShadowFormat::float32 ? total : (total - count) / depth16_scale * 2 - count;
+    return count;
+}
+
+real ShadowMap::visibility(const pointr& ndc, real bias) const {
+    if(filter == ShadowFilter::hard) return lookup(ndc.x, ndc.y) - bias > ndc.z ? 0 : 1;
+    const pointr p = to_texel(ndc);
+    const real ref = ndc.z + bias;
+    switch(filter) {
+        case ShadowFilter::pcf3x3: return 1 - (real)occluders(pcf3x3, p.x, p.y, 1, ref, NULL) / pcf3x3.n;
+        case ShadowFilter::pcf5x5: return 1 - (real)occluders(pcf5x5, p.x, p.y, 1, ref, NULL) / pcf5x5.n;
+        case ShadowFilter::poisson16: return 1 - (real)occluders(poisson16, p.x, p.y, filter_radius, ref, NULL) / poisson16.n;
+        case ShadowFilter::poisson32: return 1 - (real)occluders(poisson32, p.x, p.y, filter_radius, ref, NULL) / poisson32.n;
+        default: break;
+    }
+    // 正交投影下 NDC 的 xy 与 z 分别对应 r 与 2r 的世界长度，深度差 dz 处的半影半径约为 light_size * dz * size 个纹素。
+    // 遮挡物最远在 z = 1 处，据此确定搜索半径
+    real sum;
+    const real search = std::clamp<real>(light_size * (1 - ndc.z) * size_, 1, max_filter_radius);
+    const int blockers = occluders(poisson16, p.x, p.y, search, ref, &sum);
+    if(!blockers) return 1;
+    const real penumbra = std::clamp<real>(light_size * (sum / blockers - ndc.z) * size_, filter_radius, max_filter_radius);
+    return 1 - (real)occluders(poisson32, p.x, p.y, penumbra, ref, NULL) / poisson32.n;
+}
+
+std::vector<std::vector<int>> ShadowMap::bin(const std::vector<pointr>& corners) const {
+    const int n = tiles();
+    std::vector<std::vector<int>> bins(n * n);
+    for(size_t i = 0; i + 2 < corners.size(); i += 3) {
+        const pointr* v = &corners[i];
+        const real min_x = std::min({v[0].x, v[1].x, v[2].x}), max_x = std::max({v[0].x, v[1].x, v[2].x});
+        const real min_y = std::min({v[0].y, v[1].y, v[2].y}), max_y = std::max({v[0].y, v[1].y, v[2].y});
+        if(!(max_x >= 0 && max_y >= 0 && min_x <= size_ && min_y <= size_)) continue;
+        const int tx0 = std::max(0, (int)std::floor(min_x) / tile), tx1 = std::min(n - 1, (int)std::ceil(max_x) / tile);
+        const int ty0 = std::max(0, (int)std::floor(min_y) / tile), ty1 = std::min(n - 1, (int)std::ceil(max_y) / tile);
+        for(int ty = ty0; ty <= ty1; ty++)
+            for(int tx = tx0; tx <= tx1; tx++) bins[tx + ty * n].push_back(i);
+    }
+    return bins;
+}
+
+void ShadowMap::render_tile(const std::vector<pointr>& corners, const std::vector<int>& bin, int t) {
+    const int tx = t % tiles(), ty = t / tiles();
+    const bbox region{std::min(size_, (tx + 1) * tile) - 1, tx * tile, std::min(size_, (ty + 1) * tile) - 1, ty * tile};
+    const int w = region.max_x - region.min_x + 1, h = region.max_y - region.min_y + 1;
+    thread_local std::vector<real> local;
+    local.assign((size_t)tile * tile, -std::numeric_limits<real>::max());
+    for(int i: bin) shadow(&corners[i], local.data(), tile, region);
+    for(int y = 0; y < h; y++) {
+        const size_t row = (size_t)(region.min_y + y) * size_ + region.min_x;
+        const real* src = &local[(size_t)y * tile];
+        if(format_ == ShadowFormat::float32) {
+            for(int x = 0; x < w; x++) depth32[row + x] = src[x] > -std::numeric_limits<real>::max() ? (float)src[x] : -std::numeric_limits<float>::infinity();
+        }
+        else {
+            for(int x = 0; x < w; x++)
+                depth16[row + x] = src[x] > -std::numeric_limits<real>::max() ? encode16(src[x]) : 0;
+        }
+    }
+}
+
+void ShadowMap::render(const std::vector<pointr>& corners, ThreadPool& pool) {
+    const std::vector<std::vector<int>> bins = bin(corners);
+    // 每块只写自己的区域，互不冲突
+    pool.parallel_for(bins.size(), [&](size_t t) { render_tile(corners, bins[t], t); });
+}
+
+void ShadowMap::draw(TGAImage& image, TGAColor color, int x0) const {
+    real z_min = 0, z_max = 0;
+    bool flag = true;
+    for(int y = 0; y < size_; y++) {
+        for(int x = 0; x < size_; x++) {
+            const real z = depth(x, y);
+            if(z == -std::numeric_limits<real>::infinity()) continue;
+            if(flag) z_min = z_max = z, flag = false;
+            else z_min = std::min(z_min, z), z_max = std::max(z_max, z);
+        }
+    }
+    for(int y = 0; y < size_; y++) {
+        for(int x = 0; x < size_; x++) {
+            const real z = depth(x, y);
+            if(z != -std::numeric_limits<real>::infinity()) image.set(x0 + x, y, color * ((z - z_min) / (z_max - z_min)));
+        }
+    }
+}
+
+CascadedShadowMap::CascadedShadowMap(int cascades, int size, ShadowFormat format)
+    : maps(std::max(1, cascades), ShadowMap(size, format)), fixed(cascades <= 0) {}
+
+size_t CascadedShadowMap::bytes() const {
+    size_t total = 0;
+    for(const ShadowMap& m: maps) total += m.bytes();
+    return total;
+}
+
+void CascadedShadowMap::fit(const Light& light, const std::vector<pointr>& world_corners) {
+    const int n = maps.size();
+    eye = eye_pos;
+    forward = (center - eye_pos).normalized();
+    if(fixed) {
+        matrices = {light.light_space_matrix};
+        splits = {std::numeric_limits<real>::infinity()};
+        depth_scales = {1 / (2 * shadow_map_size)};
+        return;
+    }
+
+    // 场景到相机的深度范围，以及场景在光源视空间中的包围盒
+    real near = std::numeric_limits<real>::infinity(), far = -near;
+    real lo[3] = {near, near, near}, hi[3] = {far, far, far};
+    for(const pointr& p: world_corners) {
+        const real d = (p - eye) * forward;
+        near = std::min(near, d), far = std::max(far, d);
+        const pointr q = light.view_matrix * p;
+        for(int i = 0; i < 3; i++) lo[i] = std::min(lo[i], q[i]), hi[i] = std::max(hi[i], q[i]);
+    }
+    near = std::max<real>(near, z_near), far = std::min<real>(far, z_far);
+    if(!(far > near)) near = z_near, far = z_far;
+    if(!(hi[2] >= lo[2])) lo[2] = -2 * shadow_map_size, hi[2] = 0;
+    const real z_margin = 0.01 * (hi[2] - lo[2]) + 1e-3;
+    const real z_n = hi[2] + z_margin, z_f = lo[2] - z_margin;
+
+    // 与 VertexShader::set_projection_matrix 一致的视锥
+    const vecr cz = (eye_pos - center).normalized();
+    const vecr cx = cross(eye_up_dir, cz).normalized();
+    const vecr cy = cross(cz, cx).normalized();
+    const real tan_y = std::tan(eye_fov * 0.5 * PI / 360), tan_x = aspect_ratio * tan_y;
+
+    matrices.resize(n), splits.resize(n), depth_scales.resize(n);
+    real begin = near;
+    for(int c = 0; c < n; c++) {
+        const real k = (real)(c + 1) / n;
+        splits[c] = c + 1 == n ? far : split_lambda * near * std::pow(far / near, k) + (1 - split_lambda) * (near + (far - near) * k);
+        // 本段视锥的 8 个角点在光源视空间中的 xy 包围盒，再与场景的包围盒求交
+        real l = std::numeric_limits<real>::infinity(), r = -l, b = l, t = -l;
+        for(real d: {begin, splits[c]})
+            for(int sx = -1; sx <= 1; sx += 2)
+                for(int sy = -1; sy <= 1; sy += 2) {
+                    const pointr p = eye + forward * d + cx * (sx * d * tan_x) + cy * (sy * d * tan_y);
+                    const pointr q = light.view_matrix * p;
+                    l = std::min(l, q.x), r = std::max(r, q.x), b = std::min(b, q.y), t = std::max(t, q.y);
+                }
+        if(std::max(l, lo[0]) < std::min(r, hi[0])) l = std::max(l, lo[0]), r = std::min(r, hi[0]);
+        if(std::max(b, lo[1]) < std::min(t, hi[1])) b = std::max(b, lo[1]), t = std::min(t, hi[1]);
+        // 取正方形使纹素在两个方向上大小相同，并留出过滤半径的余量
+        const real half = std::max(r - l, t - b) * 0.5 * (1 + 2 * max_filter_radius / maps[c].size());
+        const real mx = (l + r) * 0.5, my = (b + t) * 0.5;
+        l = mx - half, r = mx + half, b = my - half, t = my + half;
+
+        mat4r ortho;
+        ortho[0][0] = 2 / (r-l); ortho[0][3] = (r+l) / (l-r);
+        ortho[1][1] = 2 / (t-b); ortho[1][3] = (t+b) / (b-t);
+        ortho[2][2] = 1 / (z_n-z_f); ortho[2][3] = z_f / (z_f-z_n);
+        ortho[3][3] = 1;
+        matrices[c] = ortho * light.view_matrix;
+        depth_scales[c] = 1 / (z_n - z_f);
+        begin = splits[c];
+    }
+}
+
+void CascadedShadowMap::render(const std::vector<pointr>& world_corners, ThreadPool& pool) {
+    render_all({this}, world_corners, pool);
+}
+
+void CascadedShadowMap::render_all(const std::vector<CascadedShadowMap*>& shadows, const std::vector<pointr>& world_corners, ThreadPool& pool) {
+    // 每个（贴图，段）先各自变换顶点并分桶
+    struct Target {
+        CascadedShadowMap* owner;
+        int cascade;
+        std::vector<pointr> corners;
+        std::vector<std::vector<int>> bins;
+    };
+    std::vector<Target> targets;
+    for(CascadedShadowMap* shadow: shadows)
+        for(int c = 0; c < shadow->cascades(); c++) targets.push_back({shadow, c, {}, {}});
+    pool.parallel_for(targets.size(), [&](size_t i) {
+        Target& target = targets[i];
+        const ShadowMap& map = target.owner->maps[target.cascade];
+        const mat4r& matrix = target.owner->matrices[target.cascade];
+        target.corners.resize(world_corners.size());
+        for(size_t j = 0; j < world_corners.size(); j++) {
+            const auto p = matrix * world_corners[j];
+            target.corners[j] = map.to_texel(pointr(p.x/p.w, p.y/p.w, p.z/p.w, 1));
+        }
+        target.bins = map.bin(target.corners);
+    });
+    std::vector<std::pair<int, int>> jobs;
+    for(size_t i = 0; i < targets.size(); i++)
+        for(size_t t = 0; t < targets[i].bins.size(); t++) jobs.emplace_back(i, t);
+    pool.parallel_for(jobs.size(), [&](size_t j) {
+        const auto [i, t] = jobs[j];
+        Target& target = targets[i];
+        target.owner->maps[target.cascade].render_tile(target.corners, target.bins[t], t);
+    });
+}
+
+real CascadedShadowMap::visibility(const pointr& world_pos, real bias) const {
+    int c = 0;
+    if(!fixed) {
+        const real d = (world_pos - eye) * forward;
+        while(c + 1 < (int)maps.size() && d > splits[c]) c++;
+    }
+    const auto p = matrices[c] * world_pos;
+    return maps[c].visibility(pointr(p.x/p.w, p.y/p.w, p.z/p.w, 1), bias * depth_scales[c]);
+}
+
+void CascadedShadowMap::draw(TGAImage& image, TGAColor color) const {
+    for(size_t c = 0; c < maps.size(); c++) maps[c].draw(image, color, c * maps[c].size());
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "texture.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace MSRender;
+
+Texture::Level& Texture::add_level(int w, int h) {
+    Level l;
+    l.width = w, l.height = h;
+    l.tiles_x = (w + tile - 1) >> tile_bits;
+    l.base = (int)texels.size();
+    const int tiles_y = (h + tile - 1) >> tile_bits;
+    texels.resize(texels.size() + (layout_ == TextureLayout::tiled ? (size_t)l.tiles_x * tiles_y * tile * tile : (size_t)w * h), 0);
+    levels.push_back(l);
+    widths.push_back(l.width), heights.push_back(l.height), tiles_xs.push_back(l.tiles_x), bases.push_back(l.base);
+    return levels.back();
+}
+
+Texture::Texture(TGAImage& img, TextureLayout layout) : layout_(layout) {
+    const int w = img.get_width(), h = img.get_height(), bpp = img.get_bytespp();
+    if(w <= 0 || h <= 0) return;
+    // 整条 mip 链约为第 0 层的 4/3
+    texels.reserve((size_t)(w + tile) * (h + tile) * 4 / 3 + 64);
+    const Level base = add_level(w, h);
+    const std::uint8_t* src = img.buffer();
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            const std::uint8_t* p = src + ((size_t)x + (size_t)y * w) * bpp;
+            std::uint32_t t = 0;
+            for(int c = 0; c < bpp; c++) t |= (std::uint32_t)p[c] << (8 * c);
+            texels[offset(base, x, y)] = t;
+        }
+    }
+
+    while(levels.back().width > 1 || levels.back().height > 1) {
+        const Level prev = levels.back();
+        const Level next = add_level(std::max(1, prev.width / 2), std::max(1, prev.height / 2));
+        for(int y = 0; y < next.height; y++) {
+            // 奇数尺寸时最后一个纹素覆盖剩下的三行（列）
+            const int y0 = std::min(2 * y, prev.height - 1);
+            const int y1 = y == next.height - 1 ? prev.height - 1 : 2 * y + 1;
+            for(int x = 0; x < next.width; x++) {
+                const int x0 = std::min(2 * x, prev.width - 1);
+                const int x1 = x == next.width - 1 ? prev.width - 1 : 2 * x + 1;
+                const int count = (x1 - x0 + 1) * (y1 - y0 + 1);
+                int sum[4] = {0, 0, 0, 0};
+                for(int sy = y0; sy <= y1; sy++) {
+                    for(int sx = x0; sx <= x1; sx++) {
+                        const std::uint32_t t = texels[offset(prev, sx, sy)];
+                        for(int c = 0; c < 4; c++) sum[c] += t >> (8 * c) & 255;
+                    }
+                }
+                std::uint32_t t = 0;
+                for(int c = 0; c < 4; c++) t |= (std::uint32_t)((sum[c] + count / 2) / count) << (8 * c);
+                texels[offset(next, x, y)] = t;
+            }
+        }
+    }
+}
+
+std::uint32_t Texture::fetch_packed(real u, real v) const {
+    if(levels.empty()) return 0;
+    const Level& l = levels[0];
+    const int x = u * l.width, y = v * l.height;
+    if(x < 0 || y < 0 || x >= l.width || y >= l.height) return 0;
+    return texels[offset(l, x, y)];
+}
+
+real Texture::lod(const uvr& dx, const uvr& dy) const {
+    const real w = levels[0].width, h = levels[0].height;
+    const real lx = (dx.u * w) * (dx.u * w) + (dx.v * h) * (dx.v * h);
+    const real ly = (dy.u * w) * (dy.u * w) + (dy.v * h) * (dy.v * h);
+    const real rho2 = std::max(lx, ly);
+    // log2(sqrt(rho2))
+    return rho2 > 0 ? real(0.5) * std::log2(rho2) : -std::numeric_limits<real>::infinity();
+}
+
+// 与 AVX2 版本逐条对应的标量实现，运算顺序相同，结果逐位一致
+void Texture::bilinear_scalar(const float* u, const float* v, const int* level, int begin, int n, TextureWrap wrap, float (*out)[batch]) const {
+    for(int i = begin; i < n; i++) {
+        const Level& l = levels[level[i]];
+        float uu = u[i], vv = v[i];
+        if(wrap == TextureWrap::repeat) uu -= std::floor(uu), vv -= std::floor(vv);
+        // 纹素中心在 (i + 0.5) / width 处
+        const float fx = uu * (float)l.width - 0.5f, fy = vv * (float)l.height - 0.5f;
+        const float bx = std::floor(fx), by = std::floor(fy);
+        const float tx = fx - bx, ty = fy - by;
+        int x0 = (int)bx, x1 = x0 + 1, y0 = (int)by, y1 = y0 + 1;
+        if(wrap == TextureWrap::repeat) {
+            if(x0 < 0) x0 += l.width;
+            if(y0 < 0) y0 += l.height;
+            if(x1 >= l.width) x1 -= l.width;
+            if(y1 >= l.height) y1 -= l.height;
+        }
+        x0 = std::clamp(x0, 0, l.width - 1), x1 = std::clamp(x1, 0, l.width - 1);
+        y0 = std::clamp(y0, 0, l.height - 1), y1 = std::clamp(y1, 0, l.height - 1);
+        const size_t ox0 = x_offset(l, x0), ox1 = x_offset(l, x1), oy0 = l.base + y_offset(l, y0), oy1 = l.base + y_offset(l, y1);
+        const std::uint32_t t00 = texels[ox0 + oy0], t10 = texels[ox1 + oy0];
+        const std::uint32_t t01 = texels[ox0 + oy1], t11 = texels[ox1 + oy1];
+        for(int c = 0, s = 0; c < 4; c++, s += 8) {
+            const float p00 = (float)(int)(t00 >> s & 255), p10 = (float)(int)(t10 >> s & 255);
+            const float p01 = (float)(int)(t01 >> s & 255), p11 = (float)(int)(t11 >> s & 255);
+            const float top = p00 + (p10 - p00) * tx;
+            const float bottom = p01 + (p11 - p01) * tx;
+            out[c][i] = top + (bottom - top) * ty;
+        }
+    }
+}
+
+void Texture::sample_bilinear(const float* u, const float* v, const int* level, int n, TextureWrap wrap, float (*out)[batch]) const {
+#if defined(__AVX2__)
+    if(n == batch) {
+        const __m256i lvl = _mm256_loadu_si256((const __m256i*)level);
+        const __m256i w = _mm256_i32gather_epi32(widths.data(), lvl, 4);
+        const __m256i h = _mm256_i32gather_epi32(heights.data(), lvl, 4);
+        const __m256i base = _mm256_i32gather_epi32(bases.data(), lvl, 4);
+        const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1);
+        const __m256i w1 = _mm256_sub_epi32(w, one), h1 = _mm256_sub_epi32(h, one);
+        __m256 uu = _mm256_loadu_ps(u), vv = _mm256_loadu_ps(v);
+        if(wrap == TextureWrap::repeat) {
+            uu = _mm256_sub_ps(uu, _mm256_floor_ps(uu));
+            vv = _mm256_sub_ps(vv, _mm256_floor_ps(vv));
+        }
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 fx = _mm256_sub_ps(_mm256_mul_ps(uu, _mm256_cvtepi32_ps(w)), half);
+        const __m256 fy = _mm256_sub_ps(_mm256_mul_ps(vv, _mm256_cvtepi32_ps(h)), half);
+        const __m256 bx = _mm256_floor_ps(fx), by = _mm256_floor_ps(fy);
+        const __m256 tx = _mm256_sub_ps(fx, bx), ty = _mm256_sub_ps(fy, by);
+        __m256i x0 = _mm256_cvttps_epi32(bx), y0 = _mm256_cvttps_epi32(by);
+        __m256i x1 = _mm256_add_epi32(x0, one), y1 = _mm256_add_epi32(y0, one);
+        if(wrap == TextureWrap::repeat) {
+            x0 = _mm256_add_epi32(x0, _mm256_and_si256(w, _mm256_cmpgt_epi32(zero, x0)));
+            y0 = _mm256_add_epi32(y0, _mm256_and_si256(h, _mm256_cmpgt_epi32(zero, y0)));
+            x1 = _mm256_sub_epi32(x1, _mm256_andnot_si256(_mm256_cmpgt_epi32(w, x1), w));
+            y1 = _mm256_sub_epi32(y1, _mm256_andnot_si256(_mm256_cmpgt_epi32(h, y1), h));
+        }
+        x0 = _mm256_max_epi32(zero, _mm256_min_epi32(x0, w1)), x1 = _mm256_max_epi32(zero, _mm256_min_epi32(x1, w1));
+        y0 = _mm256_max_epi32(zero, _mm256_min_epi32(y0, h1)), y1 = _mm256_max_epi32(zero, _mm256_min_epi32(y1, h1));
+        __m256i ox0, ox1, oy0, oy1;
+        if(layout_ == TextureLayout::linear) {
+            ox0 = x0, ox1 = x1;
+            oy0 = _mm256_mullo_epi32(y0, w), oy1 = _mm256_mullo_epi32(y1, w);
+        }
+        else {
+            const __m256i mask = _mm256_set1_epi32(tile - 1);
+            const __m256i row = _mm256_slli_epi32(_mm256_i32gather_epi32(tiles_xs.data(), lvl, 4), 2 * tile_bits);
+            auto xo = [&](__m256i x) {
+                return _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(x, tile_bits), 2 * tile_bits), _mm256_and_si256(x, mask));
+            };
+            auto yo = [&](__m256i y) {
+                return _mm256_or_si256(_mm256_mullo_epi32(_mm256_srli_epi32(y, tile_bits), row), _mm256_slli_epi32(_mm256_and_si256(y, mask), tile_bits));
+            };
+            ox0 = xo(x0), ox1 = xo(x1), oy0 = yo(y0), oy1 = yo(y1);
+        }
+        oy0 = _mm256_add_epi32(oy0, base), oy1 = _mm256_add_epi32(oy1, base);
+        const int* t = (const int*)texels.data();
+        const __m256i t00 = _mm256_i32gather_epi32(t, _mm256_add_epi32(ox0, oy0), 4);
+        const __m256i t10 = _mm256_i32gather_epi32(t, _mm256_add_epi32(ox1, oy0), 4);
+        const __m256i t01 = _mm256_i32gather_epi32(t, _mm256_add_epi32(ox0, oy1), 4);
+        const __m256i t11 = _mm256_i32gather_epi32(t, _mm256_add_epi32(ox1, oy1), 4);
+        const __m256i byte = _mm256_set1_epi32(255);
+        for(int c = 0; c < 4; c++) {
+            const __m128i s = _mm_cvtsi32_si128(8 * c);
+            auto channel = [&](__m256i x) { return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(x, s), byte)); };
+            const __m256 p00 = channel(t00), p10 = channel(t10), p01 = channel(t01), p11 = channel(t11);
+            const __m256 top = _mm256_add_ps(p00, _mm256_mul_ps(_mm256_sub_ps(p10, p00), tx));
+            const __m256 bottom = _mm256_add_ps(p01, _mm256_mul_ps(_mm256_sub_ps(p11, p01), tx));
+            _mm256_storeu_ps(out[c], _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), ty)));
+        }
+        return;
+    }
+#endif
+    bilinear_scalar(u, v, level, 0, n, wrap, out);
+}
+
+void Texture::sample(const float* u, const float* v, const float* lod, int n, TextureFilter filter, TextureWrap wrap, float (*out)[batch]) const {
+    if(filter == TextureFilter::nearest) {
+        for(int i = 0; i < n; i++) {
+            const std::uint32_t t = fetch_packed(u[i], v[i]);
+            for(int c = 0; c < 4; c++) out[c][i] = (float)(t >> (8 * c) & 255);
+        }
+        return;
+    }
+    // 不足一批时补齐，使 AVX2 路径总能整批计算
+    alignas(32) float uu[batch], vv[batch];
+    alignas(32) int l0[batch], l1[batch];
+    float t[batch];
+    const float last = (float)(levels.size() - 1);
+    for(int i = 0; i < batch; i++) {
+        const int k = i < n ? i : 0;
+        uu[i] = u[k], vv[i] = v[k];
+        const float lambda = lod[k] > 0 ? std::min(lod[k], last) : 0.f;
+        if(filter == TextureFilter::bilinear) l0[i] = (int)(lambda + 0.5f);
+        else {
+            l0[i] = (int)lambda;
+            l1[i] = std::min(l0[i] + 1, (int)last);
+            t[i] = lambda - (float)l0[i];
+        }
+    }
+    alignas(32) float a[4][batch];
+    sample_bilinear(uu, vv, l0, batch, wrap, a);
+    if(filter == TextureFilter::bilinear) {
+        for(int c = 0; c < 4; c++) std::copy(a[c], a[c] + n, out[c]);
+        return;
+    }
+    alignas(32) float b[4][batch];
+    sample_bilinear(uu, vv, l1, batch, wrap, b);
+    for(int c = 0; c < 4; c++)
+        for(int i = 0; i < n; i++) out[c][i] = a[c][i] + (b[c][i] - a[c][i]) * t[i];
+}
+
+vecr Texture::sample(const uvr& uv, const uvr& dx, const uvr& dy, TextureFilter filter, TextureWrap wrap) const {
+    const float u = uv.u, v = uv.v, l = filter == TextureFilter::nearest ? 0.f : (float)lod(dx, dy);
+    float out[4][batch];
+    sample(&u, &v, &l, 1, filter, wrap, out);
+    return vecr(out[0][0], out[1][0], out[2][0], out[3][0]);
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "threadpool.h"
+
+using namespace MSRender;
+
+ThreadPool::ThreadPool(size_t thread_num) {
+    if(thread_num == 0) thread_num = 1;
+    ranges.reset(new Range[thread_num]);
+    for(size_t i = 1; i < thread_num; i++)
+        workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    wake_cv.notify_all();
+    for(auto& t: workers) t.join();
+}
+
+bool ThreadPool::pop(size_t slot, size_t& index) {
+    Range& own = ranges[slot];
+    std::lock_guard<std::mutex> lock(own.mtx);
+    if(own.begin >= own.end) return false;
+    index = own.begin++;
+    return true;
+}
+
+bool ThreadPool::steal(size_t slot, size_t& index) {
+    const size_t n = size();
+    for(size_t k = 1; k < n; k++) {
+        Range& victim = ranges[(slot + k) % n];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if(victim.begin >= victim.end) continue;
+            end = victim.end;
+            begin = end - (end - victim.begin + 1) / 2;
+            victim.end = begin;
+        }
+        // 窃取到的第一个下标直接执行，其余放进自己的区间
+        index = begin;
+        Range& own = ranges[slot];
+        std::lock_guard<std::mutex> lock(own.mtx);
+        own.begin = begin + 1, own.end = end;
+        return true;
+    }
+    return false;
+}
+
+// 当前线程是否正在执行某个 parallel_for 的任务
+static thread_local bool inside_job = false;
+
+void ThreadPool::run_job(size_t slot) {
+    inside_job = true;
+    size_t i;
+    while(pop(slot, i) || steal(slot, i))
+        (*job)(i);
+    inside_job = false;
+}
+
+void ThreadPool::worker_loop(size_t slot) {
+    size_t seen = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            wake_cv.wait(lock, [&] { return stop || generation != seen; });
+            if(stop) return;
+            seen = generation;
+        }
+        run_job(slot);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if(--busy == 0) done_cv.notify_all();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& f) {
+    if(n == 0) return;
+    if(workers.empty() || n == 1 || inside_job) {
+        for(size_t i = 0; i < n; i++) f(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = &f;
+        const size_t slots = size();
+        for(size_t s = 0; s < slots; s++) {
+            std::lock_guard<std::mutex> range_lock(ranges[s].mtx);
+            ranges[s].begin = n * s / slots;
+            ranges[s].end = n * (s + 1) / slots;
+        }
+        busy = workers.size();
+        generation++;
+    }
+    wake_cv.notify_all();
+    run_job(0);
+    std::unique_lock<std::mutex> lock(mtx);
+    // 每个工作线程都确认过本轮任务后才返回，避免下一轮任务被旧线程误读
+    done_cv.wait(lock, [&] { return busy == 0; });
+    job = nullptr;
+}
\ No newline at end of file
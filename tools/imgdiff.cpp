@@ -0,0 +1,62 @@
+// 比较两张 TGA 图像，输出最大通道误差、不同像素数、平均误差与 PSNR。
+// 用法：imgdiff a.tga b.tga [-t 最大允许误差] [-o 差异图.tga]
+// 最大误差超过 -t 时返回 1，便于对比 float 与 double 构建的渲染结果
+#include "tgaimage.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        std::cerr << "usage: " << argv[0] << " a.tga b.tga [-t max_error] [-o diff.tga]\n";
+        return 2;
+    }
+    int threshold = -1;
+    const char* diff_path = nullptr;
+    for(int i = 3; i + 1 < argc; i++) {
+        if(!std::strcmp(argv[i], "-t")) threshold = std::atoi(argv[++i]);
+        else if(!std::strcmp(argv[i], "-o")) diff_path = argv[++i];
+    }
+
+    TGAImage a, b;
+    if(!a.read_tga_file(argv[1]) || !b.read_tga_file(argv[2])) return 2;
+    if(a.get_width() != b.get_width() || a.get_height() != b.get_height()) {
+        std::cerr << "image size mismatch: " << a.get_width() << "x" << a.get_height()
+                  << " vs " << b.get_width() << "x" << b.get_height() << "\n";
+        return 2;
+    }
+
+    const int w = a.get_width(), h = a.get_height();
+    TGAImage diff(w, h, TGAImage::RGB);
+    int max_err = 0;
+    size_t differ = 0;
+    double sum_abs = 0, sum_sq = 0;
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            TGAColor ca = a.get(x, y), cb = b.get(x, y);
+            int pixel_err = 0;
+            for(int c = 0; c < 3; c++) {
+                int e = std::abs((int)ca[c] - (int)cb[c]);
+                pixel_err = std::max(pixel_err, e);
+                sum_abs += e;
+                sum_sq += e * e;
+            }
+            if(pixel_err) differ++;
+            max_err = std::max(max_err, pixel_err);
+            // 差异放大 8 倍后以灰度输出
+            std::uint8_t v = (std::uint8_t)std::min(255, pixel_err * 8);
+            diff.set(x, y, TGAColor(v, v, v));
+        }
+    }
+
+    const double samples = 3.0 * w * h;
+    std::cout << "max error: " << max_err << "\n"
+              << "pixels differ: " << differ << " of " << (size_t)w * h << "\n"
+              << "mean abs error: " << sum_abs / samples << "\n";
+    if(sum_sq > 0) std::cout << "PSNR: " << 10 * std::log10(255.0 * 255.0 * samples / sum_sq) << " dB\n";
+    else std::cout << "PSNR: inf\n";
+
+    if(diff_path) diff.write_tga_file(diff_path);
+    return threshold >= 0 && max_err > threshold ? 1 : 0;
+}
\ No newline at end of file